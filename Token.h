@@ -9,6 +9,9 @@
 #ifndef _TOKEN_H_
 #define _TOKEN_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+
 typedef enum
 {
     TOK_WORD,
@@ -16,13 +19,25 @@ typedef enum
     TOK_LESSTHAN,
     TOK_GREATERTHAN,
     TOK_PIPE,
+    TOK_AMPERSAND,
     TOK_END
 } TokenType;
 
+/*
+ * A token is a slice of text. For most tokens, text points directly
+ * into the input line that was tokenized, so that line must outlive
+ * the token. Only words whose value differs from their source text
+ * (because they contained escape sequences) get storage of their own,
+ * in which case owned is true and text must be freed.
+ *
+ * Note that text is NOT nul-terminated; always use len.
+ */
 typedef struct
 {
-    TokenType type; // Type of token (WORD, QUOTED_WORD, etc.)
-    char *value;    // The actual string value of the token
+    TokenType type;     // Type of token (WORD, QUOTED_WORD, etc.)
+    bool owned;         // True if text was malloc'd for this token
+    const char *text;   // Start of the token's text
+    size_t len;         // Length of text, in bytes
 } Token;
 
 #endif /* _TOKEN_H_ */
@@ -11,11 +11,16 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 
 #include "clist.h"
 #include "Tokenize.h"
 #include "Token.h"
+#include "stats.h"
+#include "env.h"
 #include <stddef.h>
 
 // Documented in .h file
@@ -34,6 +39,8 @@ const char *TT_to_str(TokenType tt)
         return "GREATERTHAN";
     case TOK_PIPE:
         return "PIPE";
+    case TOK_AMPERSAND:
+        return "AMPERSAND";
     case TOK_END:
         return "(end)";
     default:
@@ -43,228 +50,1290 @@ const char *TT_to_str(TokenType tt)
     __builtin_unreachable();
 }
 
-// Modified handle_escape_sequence to check for allowed escape sequences
+/*
+ * The lexer is a state machine that consumes one byte at a time and
+ * never looks ahead, so it can stop at the end of any chunk of input
+ * and pick up again when the next chunk arrives, even in the middle of
+ * a quoted word or an escape sequence.
+ *
+ * It is driven entirely by the constant tables below: each byte is
+ * mapped to a character class, and the (state, class) pair selects the
+ * next state and the action to take. Nothing depends on the locale.
+ * To add an operator, give its character the class CC_OPERATOR and an
+ * entry in operator_type.
+ *
+ * Variables ($NAME or ${NAME}, outside quotes or in them) are expanded
+ * as they are lexed: the name is collected a byte at a time and its
+ * value appended to the word. The value is never split into words or
+ * lexed again. A $ that does not start a name stands for itself.
+ */
+typedef enum
+{
+    LEX_SPACE,         // Between tokens
+    LEX_WORD,          // Inside an unquoted word
+    LEX_WORD_ESCAPE,   // Just after a backslash in an unquoted word
+    LEX_QUOTE,         // Inside a quoted word
+    LEX_QUOTE_ESCAPE,  // Just after a backslash in a quoted word
+    LEX_WORD_DOLLAR,   // Just after a $ in an unquoted word
+    LEX_WORD_VAR,      // In the name of a variable in an unquoted word
+    LEX_WORD_BRACE,    // In the name of a ${variable} in an unquoted word
+    LEX_QUOTE_DOLLAR,  // Likewise, in a quoted word
+    LEX_QUOTE_VAR,
+    LEX_QUOTE_BRACE,
+    LEX_SKIP,          // Discarding the rest of a line after an error
+    LEX_NSTATES
+} LexState;
+
+typedef enum
+{
+    CC_OTHER,          // Anything that can appear in a word
+    CC_NAME,           // A letter, digit or underscore, as in a variable name
+    CC_SPACE,          // Whitespace other than newline
+    CC_NEWLINE,
+    CC_OPERATOR,       // A single-character operator; see operator_type
+    CC_QUOTE,
+    CC_BACKSLASH,
+    CC_DOLLAR,
+    CC_LBRACE,
+    CC_RBRACE,
+    CC_NCLASSES
+} CharClass;
+
+typedef enum
+{
+    ACT_NONE,          // Nothing to do
+    ACT_NEWLINE,       // End the line, if splitting lines
+    ACT_OPERATOR,      // Emit an operator token
+    ACT_START_WORD,    // A word starts with this byte
+    ACT_START_QUOTE,   // A quoted word starts after this byte
+    ACT_START_ESCAPE,  // A word starts with an escape sequence or a $
+    ACT_SCAN_WORD,     // Skip ahead to the next byte that matters in a word
+    ACT_SCAN_QUOTE,    // Likewise, in a quoted word
+    ACT_END_WORD,      // Emit the word, then lex this byte again
+    ACT_END_QUOTE,     // Emit the quoted word
+    ACT_SAVE,          // Save the word so far; an escape sequence follows
+    ACT_ESCAPE,        // Append the value of the escape sequence
+    ACT_CONTINUE,      // Backslash-newline: append nothing
+    ACT_DOLLAR,        // Append a $ that starts no name, then lex this byte again
+    ACT_VAR_NAME,      // Append this byte to the variable name
+    ACT_END_VAR,       // Append the variable's value, then lex this byte again
+    ACT_END_BRACE,     // Append the value of the ${variable} this byte ends
+    ACT_BAD_VAR        // A ${variable} with a bad name
+} LexAction;
+
+typedef struct
+{
+    unsigned char next;     // LexState
+    unsigned char action;   // LexAction
+} LexTransition;
+
+static const unsigned char char_class[256] = {
+    ['\t'] = CC_SPACE, ['\v'] = CC_SPACE, ['\f'] = CC_SPACE, ['\r'] = CC_SPACE, [' '] = CC_SPACE,
+    ['\n'] = CC_NEWLINE,
+    ['<'] = CC_OPERATOR, ['>'] = CC_OPERATOR, ['|'] = CC_OPERATOR, ['&'] = CC_OPERATOR,
+    ['"'] = CC_QUOTE,
+    ['\\'] = CC_BACKSLASH,
+    ['$'] = CC_DOLLAR, ['{'] = CC_LBRACE, ['}'] = CC_RBRACE,
+    ['a' ... 'z'] = CC_NAME, ['A' ... 'Z'] = CC_NAME, ['0' ... '9'] = CC_NAME, ['_'] = CC_NAME,
+};
+
+static const TokenType operator_type[256] = {
+    ['<'] = TOK_LESSTHAN,
+    ['>'] = TOK_GREATERTHAN,
+    ['|'] = TOK_PIPE,
+    ['&'] = TOK_AMPERSAND,
+};
+
+// Operator tokens point into these strings rather than the input
+static const char *operator_text[] = {
+    [TOK_LESSTHAN] = "<",
+    [TOK_GREATERTHAN] = ">",
+    [TOK_PIPE] = "|",
+    [TOK_AMPERSAND] = "&",
+};
+
+// The value of each legal escape sequence, or 0 if it is illegal
+static const char escape_value[256] = {
+    ['n'] = '\n', ['r'] = '\r', ['t'] = '\t',
+    ['"'] = '"', ['\\'] = '\\', [' '] = ' ',
+    ['|'] = '|', ['<'] = '<', ['>'] = '>', ['&'] = '&', ['$'] = '$',
+};
+
+#define T(state, action) { state, action }
+
+static const LexTransition transitions[LEX_NSTATES][CC_NCLASSES] = {
+    [LEX_SPACE] = {
+        [CC_OTHER] = T(LEX_WORD, ACT_START_WORD),
+        [CC_NAME] = T(LEX_WORD, ACT_START_WORD),
+        [CC_SPACE] = T(LEX_SPACE, ACT_NONE),
+        [CC_NEWLINE] = T(LEX_SPACE, ACT_NEWLINE),
+        [CC_OPERATOR] = T(LEX_SPACE, ACT_OPERATOR),
+        [CC_QUOTE] = T(LEX_QUOTE, ACT_START_QUOTE),
+        [CC_BACKSLASH] = T(LEX_WORD_ESCAPE, ACT_START_ESCAPE),
+        [CC_DOLLAR] = T(LEX_WORD_DOLLAR, ACT_START_ESCAPE),
+        [CC_LBRACE] = T(LEX_WORD, ACT_START_WORD),
+        [CC_RBRACE] = T(LEX_WORD, ACT_START_WORD),
+    },
+    [LEX_WORD] = {
+        [CC_OTHER] = T(LEX_WORD, ACT_SCAN_WORD),
+        [CC_NAME] = T(LEX_WORD, ACT_SCAN_WORD),
+        [CC_SPACE] = T(LEX_SPACE, ACT_END_WORD),
+        [CC_NEWLINE] = T(LEX_SPACE, ACT_END_WORD),
+        [CC_OPERATOR] = T(LEX_SPACE, ACT_END_WORD),
+        [CC_QUOTE] = T(LEX_SPACE, ACT_END_WORD),
+        [CC_BACKSLASH] = T(LEX_WORD_ESCAPE, ACT_SAVE),
+        [CC_DOLLAR] = T(LEX_WORD_DOLLAR, ACT_SAVE),
+        [CC_LBRACE] = T(LEX_WORD, ACT_SCAN_WORD),
+        [CC_RBRACE] = T(LEX_WORD, ACT_SCAN_WORD),
+    },
+    [LEX_WORD_ESCAPE] = {
+        [CC_OTHER] = T(LEX_WORD, ACT_ESCAPE),
+        [CC_NAME] = T(LEX_WORD, ACT_ESCAPE),
+        [CC_SPACE] = T(LEX_WORD, ACT_ESCAPE),
+        [CC_NEWLINE] = T(LEX_WORD, ACT_CONTINUE),
+        [CC_OPERATOR] = T(LEX_WORD, ACT_ESCAPE),
+        [CC_QUOTE] = T(LEX_WORD, ACT_ESCAPE),
+        [CC_BACKSLASH] = T(LEX_WORD, ACT_ESCAPE),
+        [CC_DOLLAR] = T(LEX_WORD, ACT_ESCAPE),
+        [CC_LBRACE] = T(LEX_WORD, ACT_ESCAPE),
+        [CC_RBRACE] = T(LEX_WORD, ACT_ESCAPE),
+    },
+    [LEX_QUOTE] = {
+        [CC_OTHER] = T(LEX_QUOTE, ACT_SCAN_QUOTE),
+        [CC_NAME] = T(LEX_QUOTE, ACT_SCAN_QUOTE),
+        [CC_SPACE] = T(LEX_QUOTE, ACT_SCAN_QUOTE),
+        [CC_NEWLINE] = T(LEX_QUOTE, ACT_SCAN_QUOTE),
+        [CC_OPERATOR] = T(LEX_QUOTE, ACT_SCAN_QUOTE),
+        [CC_QUOTE] = T(LEX_SPACE, ACT_END_QUOTE),
+        [CC_BACKSLASH] = T(LEX_QUOTE_ESCAPE, ACT_SAVE),
+        [CC_DOLLAR] = T(LEX_QUOTE_DOLLAR, ACT_SAVE),
+        [CC_LBRACE] = T(LEX_QUOTE, ACT_SCAN_QUOTE),
+        [CC_RBRACE] = T(LEX_QUOTE, ACT_SCAN_QUOTE),
+    },
+    [LEX_QUOTE_ESCAPE] = {
+        [CC_OTHER] = T(LEX_QUOTE, ACT_ESCAPE),
+        [CC_NAME] = T(LEX_QUOTE, ACT_ESCAPE),
+        [CC_SPACE] = T(LEX_QUOTE, ACT_ESCAPE),
+        [CC_NEWLINE] = T(LEX_QUOTE, ACT_CONTINUE),
+        [CC_OPERATOR] = T(LEX_QUOTE, ACT_ESCAPE),
+        [CC_QUOTE] = T(LEX_QUOTE, ACT_ESCAPE),
+        [CC_BACKSLASH] = T(LEX_QUOTE, ACT_ESCAPE),
+        [CC_DOLLAR] = T(LEX_QUOTE, ACT_ESCAPE),
+        [CC_LBRACE] = T(LEX_QUOTE, ACT_ESCAPE),
+        [CC_RBRACE] = T(LEX_QUOTE, ACT_ESCAPE),
+    },
+    [LEX_WORD_DOLLAR] = {
+        [CC_OTHER] = T(LEX_WORD, ACT_DOLLAR),
+        [CC_NAME] = T(LEX_WORD_VAR, ACT_VAR_NAME),
+        [CC_SPACE] = T(LEX_WORD, ACT_DOLLAR),
+        [CC_NEWLINE] = T(LEX_WORD, ACT_DOLLAR),
+        [CC_OPERATOR] = T(LEX_WORD, ACT_DOLLAR),
+        [CC_QUOTE] = T(LEX_WORD, ACT_DOLLAR),
+        [CC_BACKSLASH] = T(LEX_WORD, ACT_DOLLAR),
+        [CC_DOLLAR] = T(LEX_WORD, ACT_DOLLAR),
+        [CC_LBRACE] = T(LEX_WORD_BRACE, ACT_NONE),
+        [CC_RBRACE] = T(LEX_WORD, ACT_DOLLAR),
+    },
+    [LEX_WORD_VAR] = {
+        [CC_OTHER] = T(LEX_WORD, ACT_END_VAR),
+        [CC_NAME] = T(LEX_WORD_VAR, ACT_VAR_NAME),
+        [CC_SPACE] = T(LEX_WORD, ACT_END_VAR),
+        [CC_NEWLINE] = T(LEX_WORD, ACT_END_VAR),
+        [CC_OPERATOR] = T(LEX_WORD, ACT_END_VAR),
+        [CC_QUOTE] = T(LEX_WORD, ACT_END_VAR),
+        [CC_BACKSLASH] = T(LEX_WORD, ACT_END_VAR),
+        [CC_DOLLAR] = T(LEX_WORD, ACT_END_VAR),
+        [CC_LBRACE] = T(LEX_WORD, ACT_END_VAR),
+        [CC_RBRACE] = T(LEX_WORD, ACT_END_VAR),
+    },
+    [LEX_WORD_BRACE] = {
+        [CC_OTHER] = T(LEX_WORD, ACT_BAD_VAR),
+        [CC_NAME] = T(LEX_WORD_BRACE, ACT_VAR_NAME),
+        [CC_SPACE] = T(LEX_WORD, ACT_BAD_VAR),
+        [CC_NEWLINE] = T(LEX_WORD, ACT_BAD_VAR),
+        [CC_OPERATOR] = T(LEX_WORD, ACT_BAD_VAR),
+        [CC_QUOTE] = T(LEX_WORD, ACT_BAD_VAR),
+        [CC_BACKSLASH] = T(LEX_WORD, ACT_BAD_VAR),
+        [CC_DOLLAR] = T(LEX_WORD, ACT_BAD_VAR),
+        [CC_LBRACE] = T(LEX_WORD, ACT_BAD_VAR),
+        [CC_RBRACE] = T(LEX_WORD, ACT_END_BRACE),
+    },
+    [LEX_QUOTE_DOLLAR] = {
+        [CC_OTHER] = T(LEX_QUOTE, ACT_DOLLAR),
+        [CC_NAME] = T(LEX_QUOTE_VAR, ACT_VAR_NAME),
+        [CC_SPACE] = T(LEX_QUOTE, ACT_DOLLAR),
+        [CC_NEWLINE] = T(LEX_QUOTE, ACT_DOLLAR),
+        [CC_OPERATOR] = T(LEX_QUOTE, ACT_DOLLAR),
+        [CC_QUOTE] = T(LEX_QUOTE, ACT_DOLLAR),
+        [CC_BACKSLASH] = T(LEX_QUOTE, ACT_DOLLAR),
+        [CC_DOLLAR] = T(LEX_QUOTE, ACT_DOLLAR),
+        [CC_LBRACE] = T(LEX_QUOTE_BRACE, ACT_NONE),
+        [CC_RBRACE] = T(LEX_QUOTE, ACT_DOLLAR),
+    },
+    [LEX_QUOTE_VAR] = {
+        [CC_OTHER] = T(LEX_QUOTE, ACT_END_VAR),
+        [CC_NAME] = T(LEX_QUOTE_VAR, ACT_VAR_NAME),
+        [CC_SPACE] = T(LEX_QUOTE, ACT_END_VAR),
+        [CC_NEWLINE] = T(LEX_QUOTE, ACT_END_VAR),
+        [CC_OPERATOR] = T(LEX_QUOTE, ACT_END_VAR),
+        [CC_QUOTE] = T(LEX_QUOTE, ACT_END_VAR),
+        [CC_BACKSLASH] = T(LEX_QUOTE, ACT_END_VAR),
+        [CC_DOLLAR] = T(LEX_QUOTE, ACT_END_VAR),
+        [CC_LBRACE] = T(LEX_QUOTE, ACT_END_VAR),
+        [CC_RBRACE] = T(LEX_QUOTE, ACT_END_VAR),
+    },
+    [LEX_QUOTE_BRACE] = {
+        [CC_OTHER] = T(LEX_QUOTE, ACT_BAD_VAR),
+        [CC_NAME] = T(LEX_QUOTE_BRACE, ACT_VAR_NAME),
+        [CC_SPACE] = T(LEX_QUOTE, ACT_BAD_VAR),
+        [CC_NEWLINE] = T(LEX_QUOTE, ACT_BAD_VAR),
+        [CC_OPERATOR] = T(LEX_QUOTE, ACT_BAD_VAR),
+        [CC_QUOTE] = T(LEX_QUOTE, ACT_BAD_VAR),
+        [CC_BACKSLASH] = T(LEX_QUOTE, ACT_BAD_VAR),
+        [CC_DOLLAR] = T(LEX_QUOTE, ACT_BAD_VAR),
+        [CC_LBRACE] = T(LEX_QUOTE, ACT_BAD_VAR),
+        [CC_RBRACE] = T(LEX_QUOTE, ACT_END_BRACE),
+    },
+    [LEX_SKIP] = {
+        [CC_OTHER] = T(LEX_SKIP, ACT_NONE),
+        [CC_NAME] = T(LEX_SKIP, ACT_NONE),
+        [CC_SPACE] = T(LEX_SKIP, ACT_NONE),
+        [CC_NEWLINE] = T(LEX_SPACE, ACT_NONE),
+        [CC_OPERATOR] = T(LEX_SKIP, ACT_NONE),
+        [CC_QUOTE] = T(LEX_SKIP, ACT_NONE),
+        [CC_BACKSLASH] = T(LEX_SKIP, ACT_NONE),
+        [CC_DOLLAR] = T(LEX_SKIP, ACT_NONE),
+        [CC_LBRACE] = T(LEX_SKIP, ACT_NONE),
+        [CC_RBRACE] = T(LEX_SKIP, ACT_NONE),
+    },
+};
+
+#undef T
+
+// Documented in .h file
 char handle_escape_sequence(char next_char, char *errmsg, size_t errmsg_sz)
 {
-    switch (next_char)
+    char value = escape_value[(unsigned char) next_char];
+
+    if (value == '\0')
+        snprintf(errmsg, errmsg_sz, "Illegal escape character '%c'", next_char);
+
+    return value;
+}
+
+typedef enum
+{
+    LEX_MORE,          // The chunk was consumed; feed more input
+    LEX_LINE,          // An unquoted newline ended the current line
+    LEX_ERROR          // An error was found; see errmsg
+} LexResult;
+
+// A growable buffer of text
+typedef struct
+{
+    char *text;
+    size_t len;
+    size_t cap;
+} TextBuf;
+
+struct _tok_stream
+{
+    LexState state;
+    bool split_lines;    // Unquoted newlines end a line (streaming only)
+    bool borrow;         // Tokens may point into the input (one-shot only)
+    TextBuf buf;         // Text of the pending word not in the input
+    TextBuf name;        // Name of the variable being lexed
+    bool expanded;       // Whether the pending word had a variable in it
+    const char *tail;    // Unsaved end of the pending word (borrowing only)
+    const char *tail_end;
+    CList tokens;        // Tokens of the line being lexed
+    Arena arena;         // Storage for tokens and word copies, or NULL
+    uint64_t lex_ns;     // Time spent lexing the current line (statistics)
+    TOK_line_callback callback;
+    void *cb_data;
+    char errmsg[256];
+};
+
+/*
+ * Delimiter scanners. In the states that scan, the lexer has nothing
+ * to do until it reaches a byte whose transition is anything other
+ * than "keep scanning". These functions find the next such stop byte,
+ * a vector at a time where the CPU allows. Every variant returns the
+ * same answer: the index of the first stop byte in p[0..len), or len
+ * if there is none.
+ *
+ * The stop sets are derived from the transition table at startup, so
+ * they can never disagree with it.
+ */
+#define LEX_MAX_STOPS 16
+
+typedef struct
+{
+    bool stop[256];                       // Whether each byte is a stop
+    int nbytes;                           // Number of stop bytes, or -1
+    unsigned char bytes[LEX_MAX_STOPS];   //   if too many to vectorize
+#ifdef __SSE2__
+    __m128i vec[LEX_MAX_STOPS];           // Each stop byte, broadcast
+#endif
+} StopSet;
+
+static StopSet word_stops, quote_stops;
+
+typedef size_t (*scan_fn)(const StopSet *set, const char *p, size_t len);
+
+static size_t scan_scalar(const StopSet *set, const char *p, size_t len)
+{
+    size_t i = 0;
+    while (i < len && !set->stop[(unsigned char) p[i]])
+        i++;
+    return i;
+}
+
+#ifdef __SSE2__
+static size_t scan_sse2(const StopSet *set, const char *p, size_t len)
+{
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
     {
-    case 'n':
-        return '\n'; // New line
-    case 'r':
-        return '\r'; // Carriage return
-    case 't':
-        return '\t'; // Tab
-    case '"':
-        return '\"'; // Double quote
-    case '\\':
-        return '\\'; // Backslash
-    case ' ':
-        return ' '; // Space (allowed after backslash)
-    case '|':
-        return '|'; // Pipe
-    case '<':
-        return '<'; // Less than
-    case '>':
-        return '>'; // Greater than
-    default:
-        // Report error for illegal escape sequences
-        snprintf(errmsg, errmsg_sz, "Unrecognized escape sequence: \\%c", next_char);
-        return '\0'; // Indicate an error
+        __m128i v = _mm_loadu_si128((const __m128i *) &p[i]);
+        __m128i m = _mm_setzero_si128();
+        for (int k = 0; k < set->nbytes; k++)
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, set->vec[k]));
+        int bits = _mm_movemask_epi8(m);
+        if (bits)
+            return i + __builtin_ctz(bits);
     }
+    return i + scan_scalar(set, &p[i], len - i);
 }
+#endif // __SSE2__
 
-// Modified TOK_tokenize_input to handle illegal backslash escape cases
-CList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz)
+#ifdef __x86_64__
+__attribute__((target("avx2")))
+static size_t scan_avx2(const StopSet *set, const char *p, size_t len)
 {
-    CList tokens = CL_new();
-    size_t i = 0;
+    if (len < 32)
+        return scan_sse2(set, p, len);
 
-    if (!input)
+    __m256i vec[LEX_MAX_STOPS];
+    for (int k = 0; k < set->nbytes; k++)
+        vec[k] = _mm256_broadcastsi128_si256(set->vec[k]);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
     {
-        snprintf(errmsg, errmsg_sz, "Null input provided");
-        return NULL;
+        __m256i v = _mm256_loadu_si256((const __m256i *) &p[i]);
+        __m256i m = _mm256_setzero_si256();
+        for (int k = 0; k < set->nbytes; k++)
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, vec[k]));
+        unsigned bits = (unsigned) _mm256_movemask_epi8(m);
+        if (bits)
+            return i + __builtin_ctz(bits);
     }
+    return i + scan_sse2(set, &p[i], len - i);
+}
+#endif // __x86_64__
+
+// The scanner in use, chosen for this CPU before main runs
+static scan_fn scan_vector = scan_scalar;
+
+/*
+ * Finds the next stop byte, using the vector scanner when the set is
+ * small enough for it
+ *
+ * Parameters:
+ *   set       The stop set
+ *   p         The bytes to scan
+ *   len       The number of bytes in p
+ * 
+ * Returns: The index of the first stop byte, or len if there is none
+ */
+static inline size_t scan(const StopSet *set, const char *p, size_t len)
+{
+    return (set->nbytes < 0) ? scan_scalar(set, p, len) : scan_vector(set, p, len);
+}
+
+/*
+ * Fills in a stop set: every byte that does not continue the given
+ * scanning action in the given state
+ *
+ * Parameters:
+ *   set       The stop set
+ *   state     A state with a scanning action
+ *   action    The scanning action
+ * 
+ * Returns: None
+ */
+static void build_stop_set(StopSet *set, LexState state, LexAction action)
+{
+    set->nbytes = 0;
 
-    while (input[i] != '\0')
+    for (int c = 0; c < 256; c++)
     {
-        if (isspace(input[i]))
-        {
-            i++;
+        set->stop[c] = transitions[state][char_class[c]].action != action;
+        if (!set->stop[c] || set->nbytes < 0)
             continue;
-        }
-
-        Token token = {0};
 
-        // Handle special characters
-        if (input[i] == '<' || input[i] == '>' || input[i] == '|')
+        if (set->nbytes == LEX_MAX_STOPS)
         {
-            token.type = (input[i] == '<') ? TOK_LESSTHAN : (input[i] == '>') ? TOK_GREATERTHAN : TOK_PIPE;
-            token.value = strndup(&input[i], 1);
-            CL_append(tokens, token);
-            i++;
+            set->nbytes = -1;
             continue;
         }
+        set->bytes[set->nbytes] = (unsigned char) c;
+#ifdef __SSE2__
+        set->vec[set->nbytes] = _mm_set1_epi8((char) c);
+#endif
+        set->nbytes++;
+    }
+}
+
+__attribute__((constructor))
+static void init_lexer(void)
+{
+    build_stop_set(&word_stops, LEX_WORD, ACT_SCAN_WORD);
+    build_stop_set(&quote_stops, LEX_QUOTE, ACT_SCAN_QUOTE);
+
+#ifdef __SSE2__
+    scan_vector = scan_sse2;
+#endif
+#ifdef __x86_64__
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        scan_vector = scan_avx2;
+#endif
+}
+
+/*
+ * Appends len bytes to a buffer, growing it as needed
+ *
+ * Parameters:
+ *   buf       The buffer
+ *   text      The bytes to append
+ *   len       The number of bytes to append
+ * 
+ * Returns: None
+ */
+static void buf_append(TextBuf *buf, const char *text, size_t len)
+{
+    if (len == 0)
+        return;
+
+    if (buf->len + len > buf->cap)
+    {
+        size_t cap = buf->cap ? buf->cap : 64;
+        while (cap < buf->len + len)
+            cap *= 2;
+        buf->text = realloc(buf->text, cap);
+        assert(buf->text);
+        buf->cap = cap;
+    }
+
+    memcpy(&buf->text[buf->len], text, len);
+    buf->len += len;
+}
+
+/*
+ * Appends the value of the variable whose name has been collected to
+ * the pending word. Unset variables have an empty value.
+ *
+ * Parameters:
+ *   ts        The lexer state
+ * 
+ * Returns: None
+ */
+static void expand_var(struct _tok_stream *ts)
+{
+    buf_append(&ts->name, "", 1);
+
+    // A line may be tokenized off the main thread, by parallel
+    EN_read_lock();
+    const char *value = EN_get(ts->name.text);
+    if (value)
+        buf_append(&ts->buf, value, strlen(value));
+    EN_read_unlock();
+
+    ts->name.len = 0;
+    ts->expanded = true;
+}
+
+/*
+ * Appends a token referring to len bytes of text
+ *
+ * Parameters:
+ *   tokens    The list of tokens
+ *   type      The type of the token
+ *   text      The start of the token's text
+ *   len       The length of the token's text
+ *   owned     Whether text was malloc'd for this token
+ * 
+ * Returns: None
+ */
+static void append_token(CList tokens, TokenType type, const char *text, size_t len, bool owned)
+{
+    Token token = {.type = type, .owned = owned, .text = text, .len = len};
+    CL_append(tokens, token);
+}
+
+/*
+ * Completes the pending word. Its text is whatever has been saved in
+ * the buffer followed by the bytes [span, end) of the current chunk.
+ * When borrowing and nothing was buffered, the token is a slice of the
+ * input; otherwise it gets a copy of its own, from the arena if there
+ * is one.
+ *
+ * Parameters:
+ *   ts        The lexer state
+ *   type      TOK_WORD or TOK_QUOTED_WORD
+ *   span      Start of the word's unsaved text in the chunk, or NULL
+ *   end       End of the word's text in the chunk
+ * 
+ * Returns: None
+ */
+static void emit_word(struct _tok_stream *ts, TokenType type, const char *span, const char *end)
+{
+    size_t span_len = span ? (size_t) (end - span) : 0;
+    bool expanded = ts->expanded;
+    ts->expanded = false;
+
+    // An unquoted word that was only unset or empty variables is no word
+    if (type == TOK_WORD && expanded && ts->buf.len + span_len == 0)
+        return;
+
+    if (ts->buf.len == 0 && ts->borrow)
+    {
+        append_token(ts->tokens, type, span_len ? span : "", span_len, false);
+        return;
+    }
+
+    size_t len = ts->buf.len + span_len;
+    if (len == 0)
+    {
+        append_token(ts->tokens, type, "", 0, false);
+        return;
+    }
+
+    char *text = ts->arena ? AR_alloc(ts->arena, len) : malloc(len);
+    assert(text);
+    if (ts->buf.len > 0)
+        memcpy(text, ts->buf.text, ts->buf.len);
+    if (span_len > 0)
+        memcpy(&text[ts->buf.len], span, span_len);
+
+    append_token(ts->tokens, type, text, len, ts->arena == NULL);
+    ts->buf.len = 0;
+}
+
+/*
+ * Runs the lexer over a chunk of input, stopping early at the end of a
+ * line (when splitting lines) or at an error
+ *
+ * Parameters:
+ *   ts        The lexer state
+ *   chunk     The input
+ *   len       The number of bytes in chunk
+ *   consumed  Return space for the number of bytes of chunk consumed
+ * 
+ * Returns: LEX_MORE if all of chunk was consumed, LEX_LINE if a line
+ *   ended, or LEX_ERROR with the message in ts->errmsg
+ */
+static LexResult lex_chunk(struct _tok_stream *ts, const char *chunk, size_t len, size_t *consumed)
+{
+    // Start of the current word's text that has not yet been saved
+    const char *span = (ts->state == LEX_WORD || ts->state == LEX_QUOTE) ? chunk : NULL;
+    size_t i = 0;
 
-        // Check for escape sequences
-        if (input[i] == '\\') // Backslash detected, check the next character
+    while (i < len)
+    {
+        unsigned char c = (unsigned char) chunk[i];
+        LexTransition t = transitions[ts->state][char_class[c]];
+        ts->state = t.next;
+
+        switch ((LexAction) t.action)
         {
-            if (input[i + 1] == '\0') // If the backslash is the last character, it's an error
+        case ACT_NONE:
+            break;
+
+        case ACT_NEWLINE:
+            if (ts->split_lines)
             {
-                snprintf(errmsg, errmsg_sz, "Trailing backslash at the end of input");
-                free_token_values(tokens);
-                return NULL;
+                *consumed = i + 1;
+                return LEX_LINE;
             }
+            break;
 
-            // Process the escape sequence (next character after the backslash)
-            char next_char = input[i + 1];
-            char result = handle_escape_sequence(next_char, errmsg, errmsg_sz);
+        case ACT_OPERATOR:
+            append_token(ts->tokens, operator_type[c], operator_text[operator_type[c]], 1, false);
+            break;
 
-            if (result == '\0') // If handle_escape_sequence returns '\0', there's an error
-            {
-                free_token_values(tokens);
-                return NULL;
-            }
+        case ACT_START_WORD:
+            span = &chunk[i];
+            break;
+
+        case ACT_START_QUOTE:
+            span = &chunk[i + 1];
+            break;
 
-            token.type = TOK_WORD; // Treat the result as a valid token
-            token.value = strndup(&result, 1); // Copy the escaped character
-            CL_append(tokens, token);
-            i += 2; // Move past the backslash and the escaped character
+        case ACT_START_ESCAPE:
+            span = NULL;
+            break;
+
+        case ACT_SCAN_WORD:
+            // Skip straight to the next byte of interest
+            i += 1 + scan(&word_stops, &chunk[i + 1], len - i - 1);
             continue;
-        }
 
-        char buffer[256];
-        size_t buf_idx = 0;
+        case ACT_SCAN_QUOTE:
+            i += 1 + scan(&quote_stops, &chunk[i + 1], len - i - 1);
+            continue;
 
-        // Process quoted and unquoted tokens
-        if (input[i] == '"') // Start of a quoted word
-        {
-            i++; // Skip the opening quote
-            while (input[i] != '\0' && (input[i] != '"' || (i > 0 && input[i - 1] == '\\'))) // Look for the closing quote or escape sequence
-            {
-                if (input[i] == '\\' && (input[i + 1] == '"' || input[i + 1] == '\\')) // Handle escaped quotes and backslashes
-                {
-                    buffer[buf_idx++] = input[i + 1];
-                    i += 2;
-                }
-                else
-                {
-                    buffer[buf_idx++] = input[i++];
-                }
-
-                if (buf_idx >= sizeof(buffer) - 1)
-                {
-                    snprintf(errmsg, errmsg_sz, "Token too long");
-                    free_token_values(tokens);
-                    return NULL;
-                }
-            }
+        case ACT_END_WORD:
+            // The delimiter ends the word, and is then lexed on its own
+            emit_word(ts, TOK_WORD, span, &chunk[i]);
+            continue;
+
+        case ACT_END_QUOTE:
+            emit_word(ts, TOK_QUOTED_WORD, span, &chunk[i]);
+            break;
 
-            if (input[i] != '"') // If we end without a closing quote, report an error
+        case ACT_SAVE:
+            if (span)
+                buf_append(&ts->buf, span, &chunk[i] - span);
+            break;
+
+        case ACT_ESCAPE:
+            if (escape_value[c] == '\0')
             {
-                snprintf(errmsg, errmsg_sz, "Unterminated quote");
-                free_token_values(tokens);
-                return NULL;
+                handle_escape_sequence(c, ts->errmsg, sizeof(ts->errmsg));
+                *consumed = i + 1;
+                return LEX_ERROR;
             }
+            buf_append(&ts->buf, &escape_value[c], 1);
+            span = &chunk[i + 1];
+            break;
+
+        case ACT_CONTINUE:
+            span = &chunk[i + 1];
+            break;
 
-            token.type = TOK_QUOTED_WORD;
-            buffer[buf_idx] = '\0';
-            token.value = strdup(buffer);
-            CL_append(tokens, token);
-            i++; // Skip the closing quote
+        case ACT_DOLLAR:
+            buf_append(&ts->buf, "$", 1);
+            span = &chunk[i];
             continue;
-        }
 
-        // Process unquoted word
-        while (input[i] != '\0' && !isspace(input[i]) && input[i] != '<' && input[i] != '>' && input[i] != '|')
-        {
-            buffer[buf_idx++] = input[i++];
-            if (buf_idx >= sizeof(buffer) - 1)
+        case ACT_VAR_NAME:
+            buf_append(&ts->name, &chunk[i], 1);
+            break;
+
+        case ACT_END_VAR:
+            expand_var(ts);
+            span = &chunk[i];
+            continue;
+
+        case ACT_END_BRACE:
+            if (ts->name.len == 0)
             {
-                snprintf(errmsg, errmsg_sz, "Token too long");
-                free_token_values(tokens);
-                return NULL;
+                snprintf(ts->errmsg, sizeof(ts->errmsg), "Bad substitution: ${}");
+                *consumed = i + 1;
+                return LEX_ERROR;
             }
+            expand_var(ts);
+            span = &chunk[i + 1];
+            break;
+
+        case ACT_BAD_VAR:
+            snprintf(ts->errmsg, sizeof(ts->errmsg), "Bad substitution: ${%.*s%.*s",
+                     (int) ts->name.len, ts->name.text, (c > ' ' && c < 0x7f), (const char *) &chunk[i]);
+
+            // The byte may be the newline that ends the line
+            *consumed = i;
+            return LEX_ERROR;
         }
 
-        if (buf_idx > 0) // If a valid word was found
+        i++;
+    }
+
+    // Save any partial word, as the chunk may not outlive this call;
+    // when borrowing, just remember where it is
+    if (span && (ts->state == LEX_WORD || ts->state == LEX_QUOTE))
+    {
+        if (ts->borrow)
         {
-            buffer[buf_idx] = '\0';
-            token.type = TOK_WORD;
-            token.value = strdup(buffer);
-            CL_append(tokens, token);
+            ts->tail = span;
+            ts->tail_end = &chunk[len];
         }
+        else
+            buf_append(&ts->buf, span, &chunk[len] - span);
+    }
+
+    *consumed = len;
+    return LEX_MORE;
+}
+
+/*
+ * Completes the current line at the end of input
+ *
+ * Parameters:
+ *   ts        The lexer state
+ * 
+ * Returns: LEX_LINE on success, or LEX_ERROR with the message in
+ *   ts->errmsg
+ */
+static LexResult lex_end(struct _tok_stream *ts)
+{
+    switch (ts->state)
+    {
+    case LEX_WORD:
+        emit_word(ts, TOK_WORD, ts->tail, ts->tail_end);
+        break;
+    case LEX_WORD_DOLLAR:
+        buf_append(&ts->buf, "$", 1);
+        emit_word(ts, TOK_WORD, NULL, NULL);
+        break;
+    case LEX_WORD_VAR:
+        expand_var(ts);
+        emit_word(ts, TOK_WORD, NULL, NULL);
+        break;
+    case LEX_WORD_BRACE:
+        snprintf(ts->errmsg, sizeof(ts->errmsg), "Missing } after ${");
+        return LEX_ERROR;
+    case LEX_WORD_ESCAPE:
+        snprintf(ts->errmsg, sizeof(ts->errmsg), "Trailing backslash at the end of input");
+        return LEX_ERROR;
+    case LEX_QUOTE:
+    case LEX_QUOTE_ESCAPE:
+    case LEX_QUOTE_DOLLAR:
+    case LEX_QUOTE_VAR:
+    case LEX_QUOTE_BRACE:
+        snprintf(ts->errmsg, sizeof(ts->errmsg), "Unterminated quote");
+        return LEX_ERROR;
+    case LEX_SPACE:
+    case LEX_SKIP:
+    case LEX_NSTATES:
+        break;
+    }
+
+    ts->state = LEX_SPACE;
+    return LEX_LINE;
+}
+
+/*
+ * Resets the lexer state for the start of a new line, discarding any
+ * partial word
+ *
+ * Parameters:
+ *   ts        The lexer state
+ *   state     The state to start in
+ * 
+ * Returns: None
+ */
+static void lex_reset(struct _tok_stream *ts, LexState state)
+{
+    ts->state = state;
+    ts->buf.len = 0;
+    ts->name.len = 0;
+    ts->expanded = false;
+    ts->tail = ts->tail_end = NULL;
+    ts->lex_ns = 0;
+    ts->tokens = CL_new_in(ts->arena);
+}
+
+// Modified TOK_tokenize_input to handle illegal backslash escape cases
+CList TOK_tokenize_input(const char *input, Arena arena, char *errmsg, size_t errmsg_sz)
+{
+    if (!input)
+    {
+        snprintf(errmsg, errmsg_sz, "Null input provided");
+        return NULL;
+    }
+
+    uint64_t start = ST_start();
+
+    struct _tok_stream ts = {.split_lines = false, .borrow = true, .arena = arena};
+    lex_reset(&ts, LEX_SPACE);
+
+    size_t consumed;
+    LexResult result = lex_chunk(&ts, input, strlen(input), &consumed);
+    if (result != LEX_ERROR)
+        result = lex_end(&ts);
+
+    free(ts.buf.text);
+    free(ts.name.text);
+    ST_record(ST_TOKENIZE, start);
+
+    if (result == LEX_ERROR)
+    {
+        snprintf(errmsg, errmsg_sz, "%s", ts.errmsg);
+        free_token_values(ts.tokens);
+        return NULL;
     }
 
     // Add end-of-input token
-    Token end_token = {.type = TOK_END, .value = NULL};
-    CL_append(tokens, end_token);
+    append_token(ts.tokens, TOK_END, NULL, 0, false);
+
+    return ts.tokens;
+}
+
+/*
+ * Hands a completed line to the stream's callback, then starts a new
+ * one. Blank lines are not reported.
+ *
+ * Parameters:
+ *   ts        The stream
+ * 
+ * Returns: None
+ */
+static void stream_deliver_line(TokStream ts)
+{
+    if (CL_length(ts->tokens) > 0)
+    {
+        append_token(ts->tokens, TOK_END, NULL, 0, false);
+        ST_record_ns(ST_TOKENIZE, ts->lex_ns);
+        ts->callback(ts->tokens, NULL, ts->cb_data);
+    }
+
+    // Everything the line allocated goes at once
+    AR_reset(ts->arena);
+    lex_reset(ts, LEX_SPACE);
+}
+
+/*
+ * Reports an error to the stream's callback, then discards the rest of
+ * the current line
+ *
+ * Parameters:
+ *   ts        The stream
+ *   state     The state to resume in
+ * 
+ * Returns: None
+ */
+static void stream_deliver_error(TokStream ts, LexState state)
+{
+    ts->callback(NULL, ts->errmsg, ts->cb_data);
 
-    return tokens;
+    AR_reset(ts->arena);
+    lex_reset(ts, state);
 }
 
 // Documented in .h file
-void free_token_values(CList tokens)
+TokStream TOK_stream_new(TOK_line_callback callback, void *cb_data)
 {
-    if (tokens == NULL) 
-        return;
+    assert(callback);
+
+    TokStream ts = calloc(1, sizeof(struct _tok_stream));
+    assert(ts);
+
+    ts->split_lines = true;
+    ts->borrow = false;
+    ts->callback = callback;
+    ts->cb_data = cb_data;
+    ts->arena = AR_new();
+    lex_reset(ts, LEX_SPACE);
+
+    return ts;
+}
+
+// Documented in .h file
+void TOK_stream_feed(TokStream ts, const char *chunk, size_t len)
+{
+    assert(ts);
 
-    // Iterate through the tokens and free each token's value
-    size_t length = CL_length(tokens);
-    for (size_t i = 0; i < length; i++) 
+    while (len > 0)
     {
-        Token token = CL_nth(tokens, i);
-        
-        // Free the dynamically allocated value string
-        // But only for tokens that have a non-NULL value
-        if (token.value != NULL) 
+        size_t consumed;
+        uint64_t start = ST_start();
+        LexResult result = lex_chunk(ts, chunk, len, &consumed);
+        ts->lex_ns += ST_since(start);
+
+        if (result == LEX_LINE)
+        {
+            stream_deliver_line(ts);
+        }
+        else if (result == LEX_ERROR)
         {
-            free(token.value);
+            stream_deliver_error(ts, LEX_SKIP);
         }
+
+        chunk += consumed;
+        len -= consumed;
     }
+}
 
-    // Optional: Clear the list after freeing values
-    CL_free(tokens);
+// Documented in .h file
+void TOK_stream_finish(TokStream ts)
+{
+    assert(ts);
+
+    if (lex_end(ts) == LEX_ERROR)
+        stream_deliver_error(ts, LEX_SPACE);
+    else
+        stream_deliver_line(ts);
 }
+
 // Documented in .h file
-TokenType TOK_next_type(CList tokens)
+void TOK_stream_free(TokStream ts)
+{
+    if (ts == NULL)
+        return;
+
+    AR_free(ts->arena);
+    free(ts->buf.text);
+    free(ts->name.text);
+    free(ts);
+}
+
+/*
+ * Highlighting. The lexer always reaches the start of a token in
+ * LEX_SPACE, so the end of any token that was ended by unchanged text
+ * is a safe place to start lexing again, and the start of any old
+ * token in unchanged text is a safe place to stop.
+ */
+struct _tok_highlighter
+{
+    char *text;          // The line last highlighted
+    size_t len;
+    size_t cap;
+    TokSpan *spans;      // Its spans
+    int nspans;
+    int spans_cap;
+    TokSpan *relexed;    // Spans of the part lexed again
+    int relexed_cap;
+};
+
+/*
+ * Lexes the next token of a line for highlighting, without building
+ * it
+ *
+ * Parameters:
+ *   line      The line
+ *   pos       Where to start, in LEX_SPACE
+ *   len       The length of line
+ *   span      Return space for the token
+ * 
+ * Returns: true if a token was found, false at the end of the line
+ */
+static bool lex_span(const char *line, size_t pos, size_t len, TokSpan *span)
+{
+    size_t i = pos;
+
+    // Skip the space before the token
+    for (; i < len; i++)
+    {
+        LexAction action = transitions[LEX_SPACE][char_class[(unsigned char) line[i]]].action;
+        if (action != ACT_NONE && action != ACT_NEWLINE)
+            break;
+    }
+
+    if (i == len)
+        return false;
+
+    LexState state = LEX_SPACE;
+    bool named = false;   // Whether a variable name has been started
+    span->start = i;
+    span->kind = TOK_SPAN_WORD;
+
+    while (i < len)
+    {
+        unsigned char c = (unsigned char) line[i];
+        LexTransition t = transitions[state][char_class[c]];
+        state = t.next;
+
+        switch ((LexAction) t.action)
+        {
+        case ACT_OPERATOR:
+            span->end = i + 1;
+            span->kind = TOK_SPAN_OPERATOR;
+            return true;
+
+        case ACT_START_QUOTE:
+            span->kind = TOK_SPAN_QUOTED;
+            break;
+
+        case ACT_SCAN_WORD:
+            i += 1 + scan(&word_stops, &line[i + 1], len - i - 1);
+            continue;
+
+        case ACT_SCAN_QUOTE:
+            i += 1 + scan(&quote_stops, &line[i + 1], len - i - 1);
+            continue;
+
+        case ACT_END_WORD:
+            span->end = i;
+            return true;
+
+        case ACT_END_QUOTE:
+            span->end = i + 1;
+            return true;
+
+        case ACT_ESCAPE:
+            if (escape_value[c] == '\0')
+                span->kind = TOK_SPAN_ERROR;
+            break;
+
+        case ACT_VAR_NAME:
+            named = true;
+            break;
+
+        case ACT_DOLLAR:
+        case ACT_END_VAR:
+            named = false;
+            continue;
+
+        case ACT_END_BRACE:
+        case ACT_BAD_VAR:
+            if (!named || t.action == ACT_BAD_VAR)
+                span->kind = TOK_SPAN_ERROR;
+            named = false;
+            break;
+
+        default:
+            break;
+        }
+
+        i++;
+    }
+
+    // The line ended inside the token
+    span->end = len;
+    if (state != LEX_WORD && state != LEX_WORD_DOLLAR && state != LEX_WORD_VAR)
+        span->kind = TOK_SPAN_ERROR;
+
+    return true;
+}
+
+/*
+ * Finds the first span that starts at or after an offset
+ *
+ * Parameters:
+ *   spans     The spans, in order
+ *   nspans    The number of spans
+ *   pos       The offset
+ * 
+ * Returns: The index of the span, or nspans if there is none
+ */
+static int find_span(const TokSpan *spans, int nspans, size_t pos)
 {
-    if (CL_length(tokens) == 0)
+    int lo = 0, hi = nspans;
+
+    while (lo < hi)
     {
-        return TOK_END;
+        int mid = lo + (hi - lo) / 2;
+        if (spans[mid].start < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    Token token = CL_nth(tokens, 0);
-    return token.type;
+
+    return lo;
 }
 
 // Documented in .h file
-Token TOK_next(CList tokens)
+TokHighlighter TOK_highlighter_new(void)
 {
-    return CL_nth(tokens, 0);
+    TokHighlighter hl = calloc(1, sizeof(struct _tok_highlighter));
+    assert(hl);
+
+    return hl;
 }
 
 // Documented in .h file
-void TOK_consume(CList tokens)
+int TOK_highlight(TokHighlighter hl, const char *line, size_t len,
+                  const TokSpan **spans, size_t *changed)
 {
-    if (CL_length(tokens) > 0)
+    assert(hl && line && spans && changed);
+
+    // The unchanged text before and after the edit
+    size_t min_len = (len < hl->len) ? len : hl->len;
+    size_t prefix = 0, suffix = 0;
+    while (prefix < min_len && line[prefix] == hl->text[prefix])
+        prefix++;
+    while (suffix < min_len - prefix && line[len - 1 - suffix] == hl->text[hl->len - 1 - suffix])
+        suffix++;
+
+    // Keep the spans ended by unchanged text (a word is ended by the
+    // byte after it), and start again after the last of them
+    int keep = find_span(hl->spans, hl->nspans, prefix);
+    while (keep > 0 && hl->spans[keep - 1].end >= prefix)
+        keep--;
+    size_t pos = (keep > 0) ? hl->spans[keep - 1].end : 0;
+    *changed = pos;
+
+    // Lex until back in step with an old span in the unchanged suffix
+    ptrdiff_t delta = (ptrdiff_t) len - (ptrdiff_t) hl->len;
+    int nrelexed = 0, resume = hl->nspans;
+    TokSpan span;
+
+    while (lex_span(line, pos, len, &span))
+    {
+        if (span.start >= len - suffix)
+        {
+            int old = find_span(hl->spans, hl->nspans, span.start - delta);
+            if (old < hl->nspans && hl->spans[old].start == span.start - delta)
+            {
+                resume = old;
+                break;
+            }
+        }
+
+        if (nrelexed == hl->relexed_cap)
+        {
+            hl->relexed_cap = hl->relexed_cap ? hl->relexed_cap * 2 : 64;
+            hl->relexed = realloc(hl->relexed, hl->relexed_cap * sizeof(TokSpan));
+            assert(hl->relexed);
+        }
+        hl->relexed[nrelexed++] = span;
+        pos = span.end;
+    }
+
+    // Splice: kept spans, relexed spans, then the old tail, moved
+    int ntail = hl->nspans - resume;
+    int nspans = keep + nrelexed + ntail;
+    if (nspans > hl->spans_cap)
     {
-        CL_pop(tokens);
+        hl->spans_cap = (nspans > 2 * hl->spans_cap) ? nspans : 2 * hl->spans_cap;
+        hl->spans = realloc(hl->spans, hl->spans_cap * sizeof(TokSpan));
+        assert(hl->spans);
     }
-}
 
-void printToken(int pos, CListElementType element, void *cb_data)
-{
-    if (element.type == TOK_WORD || element.type == TOK_QUOTED_WORD)
+    memmove(&hl->spans[keep + nrelexed], &hl->spans[resume], ntail * sizeof(TokSpan));
+    for (int i = keep + nrelexed; i < nspans; i++)
     {
-        printf("Position %d: Token type: %s, %s\n", pos, TT_to_str(element.type), element.value);
+        hl->spans[i].start += delta;
+        hl->spans[i].end += delta;
     }
-    else
+    if (nrelexed > 0)
+        memcpy(&hl->spans[keep], hl->relexed, nrelexed * sizeof(TokSpan));
+    hl->nspans = nspans;
+
+    // Remember the line, copying only what changed
+    if (len > hl->cap)
+    {
+        hl->cap = (len > 2 * hl->cap) ? len : 2 * hl->cap;
+        hl->text = realloc(hl->text, hl->cap);
+        assert(hl->text);
+    }
+    if (suffix > 0)
+        memmove(&hl->text[len - suffix], &hl->text[hl->len - suffix], suffix);
+    if (len - suffix > prefix)
+        memcpy(&hl->text[prefix], &line[prefix], len - suffix - prefix);
+    hl->len = len;
+
+    *spans = hl->spans;
+    return nspans;
+}
+
+// Documented in .h file
+void TOK_highlighter_reset(TokHighlighter hl)
+{
+    hl->len = 0;
+    hl->nspans = 0;
+}
+
+// Documented in .h file
+void TOK_highlighter_free(TokHighlighter hl)
+{
+    if (hl == NULL)
+        return;
+
+    free(hl->text);
+    free(hl->spans);
+    free(hl->relexed);
+    free(hl);
+}
+
+// Documented in .h file
+char *TOK_strdup(Token token)
+{
+    char *str = malloc(token.len + 1);
+    assert(str);
+
+    if (token.len > 0)
+        memcpy(str, token.text, token.len);
+    str[token.len] = '\0';
+
+    return str;
+}
+
+// Documented in .h file
+bool TOK_equals(Token token, const char *str)
+{
+    return token.text != NULL && strncmp(token.text, str, token.len) == 0 && str[token.len] == '\0';
+}
+
+// Documented in .h file
+void free_token_values(CList tokens)
+{
+    if (tokens == NULL) 
+        return;
+
+    // Iterate through the tokens and free each token's storage,
+    // but only for tokens that own their text
+    for (CL_iter it = CL_begin(tokens); !CL_done(&it); CL_next(&it))
     {
-        printf("Position %d: Token type: %s\n", pos, TT_to_str(element.type));
+        const Token *token = CL_current(&it);
+
+        if (token->owned) 
+            free((char *) token->text);
     }
+
+    CL_free(tokens);
+}
+// Documented in .h file
+TokCursor TOK_cursor(CList tokens)
+{
+    assert(tokens);
+
+    TokCursor cur = {.tokens = tokens, .pos = 0};
+    return cur;
+}
+
+// Documented in .h file
+Token TOK_peek(const TokCursor *cur, int k)
+{
+    assert(k >= 0);
+
+    // CL_nth returns a TOK_END token for positions past the end
+    return CL_nth(cur->tokens, cur->pos + k);
+}
+
+// Documented in .h file
+TokenType TOK_peek_type(const TokCursor *cur, int k)
+{
+    return TOK_peek(cur, k).type;
+}
+
+// Documented in .h file
+void TOK_advance(TokCursor *cur)
+{
+    if (cur->pos < CL_length(cur->tokens))
+        cur->pos++;
+}
+
+// Documented in .h file
+int TOK_mark(const TokCursor *cur)
+{
+    return cur->pos;
+}
+
+// Documented in .h file
+void TOK_reset(TokCursor *cur, int mark)
+{
+    assert(mark >= 0 && mark <= CL_length(cur->tokens));
+    cur->pos = mark;
 }
 
 // Documented in .h file
 void TOK_print(CList tokens)
 {
-    CL_foreach(tokens, printToken, NULL);
+    for (CL_iter it = CL_begin(tokens); !CL_done(&it); CL_next(&it))
+    {
+        const Token *token = CL_current(&it);
+
+        if (token->type == TOK_WORD || token->type == TOK_QUOTED_WORD)
+        {
+            printf("Position %d: Token type: %s, %.*s\n", it.pos, TT_to_str(token->type), (int) token->len, token->text);
+        }
+        else
+        {
+            printf("Position %d: Token type: %s\n", it.pos, TT_to_str(token->type));
+        }
+    }
 }
@@ -11,6 +11,7 @@
 
 #include "clist.h"
 #include "Token.h"
+#include "arena.h"
 #include <stddef.h>
 
 
@@ -32,6 +33,8 @@ const char *TT_to_str(TokenType tt);
  *
  * Parameters:
  *   input      The input as entered by the user
+ *   arena      Arena to allocate the list and any copied text from, or
+ *              NULL to use malloc
  *   errmsg     Return space for an error message, filled in in case of error
  *   errmsg_sz  The size of errmsg
  * 
@@ -39,45 +42,250 @@ const char *TT_to_str(TokenType tt);
  *   with one token per list element. If an error is encountered,
  *   copies an error message into errmsg and returns NULL.
  * 
- *   It is up to the caller to call CL_free on the returned list.
+ *   $NAME and ${NAME} are replaced by the value of the variable, from
+ *   env.h, as the line is tokenized.
+ *
+ *   Tokens refer to the text of input rather than copying it, so input
+ *   must remain valid for as long as the tokens are in use. It is up
+ *   to the caller to call free_token_values on the returned list, or
+ *   to reset the arena.
  */
-CList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz);
+CList TOK_tokenize_input(const char *input, Arena arena, char *errmsg, size_t errmsg_sz);
 
 
+// A resumable tokenizer that accepts its input in chunks
+// (struct _tok_stream is defined in .c file)
+typedef struct _tok_stream *TokStream;
 
 /*
- * Returns the TokenType for the next token. Does not modify the list
- * of tokens. 
+ * Called by a TokStream once for each non-blank line of input.
  *
  * Parameters:
- *   tokens    The list of tokens
+ *   tokens    The tokens of the line, ending with TOK_END, or NULL if
+ *             the line could not be tokenized. The list and its tokens
+ *             are freed by the stream when the callback returns.
+ *   errmsg    If tokens is NULL, a description of the error
+ *   cb_data   Caller data given to TOK_stream_new
+ */
+typedef void (*TOK_line_callback)(CList tokens, const char *errmsg, void *cb_data);
+
+
+/*
+ * Create a new streaming tokenizer. Unlike TOK_tokenize_input, input
+ * is split into lines at unquoted newlines, a backslash-newline is a
+ * line continuation, and every word has storage of its own, so chunks
+ * need not outlive the call that feeds them.
+ *
+ * Parameters:
+ *   callback  Function to call for each line of input
+ *   cb_data   Caller data to pass to callback
  * 
- * Returns: The TokenType for the next token, or TOK_END if the list
- *   is empty.
+ * Returns: The new stream, which must be destroyed with TOK_stream_free
  */
-TokenType TOK_next_type(CList tokens);
+TokStream TOK_stream_new(TOK_line_callback callback, void *cb_data);
 
 
 /*
- * Returns the next token. Does not modify the list of tokens.
+ * Feed the next chunk of input to a stream. Chunks may split the input
+ * anywhere, including inside a quoted word or an escape sequence. The
+ * callback is invoked for every line completed by this chunk; after an
+ * error, the rest of the offending line is discarded.
  *
  * Parameters:
- *   tokens    The list of tokens
+ *   ts        The stream
+ *   chunk     The input; need not be nul-terminated
+ *   len       The number of bytes in chunk
  * 
- * Returns: The next token.
+ * Returns: None
  */
-Token TOK_next(CList tokens);
+void TOK_stream_feed(TokStream ts, const char *chunk, size_t len);
 
 
 /*
- * Consumes (discards) the next token in the list
+ * Signal the end of input to a stream, delivering any final line that
+ * was not ended by a newline. The stream may be fed again afterwards.
+ *
+ * Parameters:
+ *   ts        The stream
+ * 
+ * Returns: None
+ */
+void TOK_stream_finish(TokStream ts);
+
+
+/*
+ * Destroy a stream, discarding any partial line
+ *
+ * Parameters:
+ *   ts        The stream; if NULL, no action will occur
+ * 
+ * Returns: None
+ */
+void TOK_stream_free(TokStream ts);
+
+
+// What a span of a command line is, for syntax highlighting
+typedef enum
+{
+    TOK_SPAN_WORD,
+    TOK_SPAN_QUOTED,     // A quoted word, including its quotes
+    TOK_SPAN_OPERATOR,
+    TOK_SPAN_ERROR       // A word that cannot be tokenized: an unterminated
+                         //   quote, a bad escape or a trailing backslash
+} TokSpanKind;
+
+// One token of a highlighted line, as the byte offsets [start, end)
+typedef struct
+{
+    size_t start;
+    size_t end;
+    TokSpanKind kind;
+} TokSpan;
+
+// An incremental lexer for highlighting a line as it is edited
+// (struct _tok_highlighter is defined in .c file)
+typedef struct _tok_highlighter *TokHighlighter;
+
+
+/*
+ * Create a new highlighter
+ *
+ * Parameters: None
+ * 
+ * Returns: The new highlighter, which must be destroyed with
+ *   TOK_highlighter_free
+ */
+TokHighlighter TOK_highlighter_new(void);
+
+
+/*
+ * Split a line into spans for highlighting. The highlighter remembers
+ * the line it was last given, and only the part from the last token
+ * before the first change is lexed again; the spans after the change
+ * are reused, moved, as soon as the lexer is back in step with them.
+ * Errors do not stop the lexer; the offending word is marked instead.
+ *
+ * Parameters:
+ *   hl        The highlighter
+ *   line      The line; need not be nul-terminated
+ *   len       The number of bytes in line
+ *   spans     Return space for the spans, in order, which are valid
+ *             until the next call
+ *   changed   Return space for the offset from which the spans may
+ *             differ from those of the previous line
+ * 
+ * Returns: The number of spans
+ */
+int TOK_highlight(TokHighlighter hl, const char *line, size_t len,
+                  const TokSpan **spans, size_t *changed);
+
+
+/*
+ * Forget the last line, so that the next is lexed from the start
+ *
+ * Parameters:
+ *   hl        The highlighter
+ * 
+ * Returns: None
+ */
+void TOK_highlighter_reset(TokHighlighter hl);
+
+
+/*
+ * Destroy a highlighter
+ *
+ * Parameters:
+ *   hl        The highlighter; if NULL, no action will occur
+ * 
+ * Returns: None
+ */
+void TOK_highlighter_free(TokHighlighter hl);
+
+
+
+/*
+ * A read position within a list of tokens. Reading through a cursor
+ * never modifies or frees the tokens, so a parser can look ahead, or
+ * back up to an earlier mark and try again; the list is freed once,
+ * with free_token_values, when the command is done with.
+ */
+typedef struct
+{
+    CList tokens;   // The tokens being read
+    int pos;        // Index of the next token
+} TokCursor;
+
+
+/*
+ * Returns a cursor positioned at the first token of a list
  *
  * Parameters:
  *   tokens    The list of tokens
  * 
+ * Returns: The cursor
+ */
+TokCursor TOK_cursor(CList tokens);
+
+
+/*
+ * Returns a token ahead of the cursor, without moving it
+ *
+ * Parameters:
+ *   cur       The cursor
+ *   k         How far ahead to look; 0 is the next token
+ * 
+ * Returns: The token, or a TOK_END token if k is past the end of
+ *   the list
+ */
+Token TOK_peek(const TokCursor *cur, int k);
+
+
+/*
+ * Returns the TokenType of a token ahead of the cursor, without
+ * moving it
+ *
+ * Parameters:
+ *   cur       The cursor
+ *   k         How far ahead to look; 0 is the next token
+ * 
+ * Returns: The TokenType, or TOK_END if k is past the end of the list
+ */
+TokenType TOK_peek_type(const TokCursor *cur, int k);
+
+
+/*
+ * Moves the cursor past the next token. Does nothing once the cursor
+ * has reached the end of the list.
+ *
+ * Parameters:
+ *   cur       The cursor
+ * 
+ * Returns: None
+ */
+void TOK_advance(TokCursor *cur);
+
+
+/*
+ * Records the cursor's position, for a later TOK_reset
+ *
+ * Parameters:
+ *   cur       The cursor
+ * 
+ * Returns: An opaque mark
+ */
+int TOK_mark(const TokCursor *cur);
+
+
+/*
+ * Moves the cursor back (or forward) to a previously recorded mark
+ *
+ * Parameters:
+ *   cur       The cursor
+ *   mark      A value returned by TOK_mark on the same cursor
+ * 
  * Returns: None
  */
-void TOK_consume(CList tokens);
+void TOK_reset(TokCursor *cur, int mark);
 
 
 /*
@@ -90,6 +298,39 @@ void TOK_consume(CList tokens);
  */
 void TOK_print(CList tokens);
 
+
+/*
+ * Returns a newly-malloc'd, nul-terminated copy of a token's text
+ *
+ * Parameters:
+ *   token     The token
+ * 
+ * Returns: The copy, which the caller must free
+ */
+char *TOK_strdup(Token token);
+
+
+/*
+ * Compares a token's text against a nul-terminated string
+ *
+ * Parameters:
+ *   token     The token
+ *   str       The string to compare against
+ * 
+ * Returns: true if the token's text is exactly str, false otherwise
+ */
+bool TOK_equals(Token token, const char *str);
+
+
+/*
+ * Frees the storage owned by any of the tokens in the list, and then
+ * the list itself
+ *
+ * Parameters:
+ *   tokens    The list of tokens; if NULL, no action will occur
+ * 
+ * Returns: None
+ */
 void free_token_values(CList tokens);
 
 #endif /* _TOKENIZE_H_ */
@@ -0,0 +1,217 @@
+/*
+ * arena.c
+ *
+ * A bump allocator built from a chain of blocks. Allocation advances a
+ * pointer through the current block, moving on to the next block (or
+ * adding one) when it is full; reset just points back at the first.
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "arena.h"
+#include "stats.h"
+
+// Under AddressSanitizer, memory that is not currently allocated is
+// poisoned, so a use after AR_reset is caught like a use after free
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/asan_interface.h>
+#else
+#define ASAN_POISON_MEMORY_REGION(addr, size) ((void) (addr), (void) (size))
+#define ASAN_UNPOISON_MEMORY_REGION(addr, size) ((void) (addr), (void) (size))
+#endif
+
+// Size of an ordinary block; larger requests get a block of their own
+#define AR_BLOCK_SIZE (64 * 1024)
+
+// If an arena holds more than this at a reset, the excess is released
+#define AR_RETAIN_MAX (4 * 1024 * 1024)
+
+// Alignment of every allocation
+#define AR_ALIGN 16
+
+struct ar_block
+{
+    struct ar_block *next;
+    size_t size;       // Usable bytes in data
+    size_t used;
+    _Alignas(AR_ALIGN) unsigned char data[];
+};
+
+struct _arena
+{
+    struct ar_block *first;
+    struct ar_block *current;
+    void *last;        // The most recent allocation, for AR_realloc
+    size_t total;      // Bytes held in all blocks
+};
+
+
+/*
+ * Allocates a block with room for at least size bytes
+ *
+ * Parameters:
+ *   size     The number of bytes needed
+ * 
+ * Returns: The new block
+ */
+static struct ar_block *new_block(size_t size)
+{
+    if (size < AR_BLOCK_SIZE)
+        size = AR_BLOCK_SIZE;
+
+    struct ar_block *block = malloc(sizeof(struct ar_block) + size);
+    assert(block);
+    ST_count(ST_HEAP_ALLOCS);
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    ASAN_POISON_MEMORY_REGION(block->data, size);
+
+    return block;
+}
+
+
+// Documented in .h file
+Arena AR_new(void)
+{
+    Arena arena = malloc(sizeof(struct _arena));
+    assert(arena);
+
+    arena->first = arena->current = new_block(AR_BLOCK_SIZE);
+    arena->last = NULL;
+    arena->total = arena->first->size;
+
+    return arena;
+}
+
+
+// Documented in .h file
+void AR_free(Arena arena)
+{
+    if (arena == NULL)
+        return;
+
+    struct ar_block *block = arena->first;
+    while (block != NULL)
+    {
+        struct ar_block *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    free(arena);
+}
+
+
+// Documented in .h file
+void *AR_alloc(Arena arena, size_t size)
+{
+    assert(arena);
+    ST_count(ST_ARENA_ALLOCS);
+
+    size = (size + AR_ALIGN - 1) & ~(size_t) (AR_ALIGN - 1);
+
+    struct ar_block *block = arena->current;
+    while (block->size - block->used < size)
+    {
+        // Move on to the next block, which is empty since the last
+        // reset, or insert a new one if it is too small
+        struct ar_block *next = block->next;
+        if (next == NULL || next->size < size)
+        {
+            struct ar_block *added = new_block(size);
+            added->next = next;
+            block->next = added;
+            arena->total += added->size;
+            next = added;
+        }
+        next->used = 0;
+        block = arena->current = next;
+    }
+
+    void *ptr = &block->data[block->used];
+    block->used += size;
+    arena->last = ptr;
+    ASAN_UNPOISON_MEMORY_REGION(ptr, size);
+
+    return ptr;
+}
+
+
+// Documented in .h file
+void *AR_realloc(Arena arena, void *ptr, size_t old_size, size_t new_size)
+{
+    assert(arena);
+
+    if (ptr == NULL)
+        return AR_alloc(arena, new_size);
+
+    if (new_size <= old_size)
+        return ptr;
+
+    // The most recent allocation can grow into the rest of its block
+    struct ar_block *block = arena->current;
+    if (ptr == arena->last)
+    {
+        size_t offset = (unsigned char *) ptr - block->data;
+        size_t size = (new_size + AR_ALIGN - 1) & ~(size_t) (AR_ALIGN - 1);
+        if (offset + size <= block->size)
+        {
+            block->used = offset + size;
+            ASAN_UNPOISON_MEMORY_REGION(ptr, size);
+            return ptr;
+        }
+    }
+
+    void *grown = AR_alloc(arena, new_size);
+    memcpy(grown, ptr, old_size);
+    return grown;
+}
+
+
+// Documented in .h file
+char *AR_strndup(Arena arena, const char *str, size_t len)
+{
+    char *copy = AR_alloc(arena, len + 1);
+
+    if (len > 0)
+        memcpy(copy, str, len);
+    copy[len] = '\0';
+
+    return copy;
+}
+
+
+// Documented in .h file
+void AR_reset(Arena arena)
+{
+    assert(arena);
+
+    if (arena->total > AR_RETAIN_MAX)
+    {
+        // Give back what an unusually large command left behind
+        struct ar_block *block = arena->first->next;
+        while (block != NULL)
+        {
+            struct ar_block *next = block->next;
+            free(block);
+            block = next;
+        }
+        arena->first->next = NULL;
+        arena->total = arena->first->size;
+    }
+
+#ifdef __SANITIZE_ADDRESS__
+    for (struct ar_block *block = arena->first; block != NULL; block = block->next)
+        ASAN_POISON_MEMORY_REGION(block->data, block->size);
+#endif
+
+    arena->current = arena->first;
+    arena->first->used = 0;
+    arena->last = NULL;
+}
@@ -0,0 +1,95 @@
+/*
+ * arena.h
+ *
+ * A bump allocator for objects that all die at the same time, such as
+ * everything allocated while running one command
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+// struct _arena is defined in .c file
+typedef struct _arena *Arena;
+
+
+/*
+ * Create a new, empty arena
+ *
+ * Parameters: None
+ * 
+ * Returns: The new arena, to be destroyed with AR_free
+ */
+Arena AR_new(void);
+
+
+/*
+ * Destroy an arena and everything allocated from it
+ *
+ * Parameters:
+ *   arena    The arena; if NULL, no action will occur
+ * 
+ * Returns: None
+ */
+void AR_free(Arena arena);
+
+
+/*
+ * Allocate memory from an arena. The memory is suitably aligned for
+ * any type, and remains valid until the arena is reset or freed; it
+ * cannot be freed individually.
+ *
+ * Parameters:
+ *   arena    The arena
+ *   size     The number of bytes needed
+ * 
+ * Returns: The memory
+ */
+void *AR_alloc(Arena arena, size_t size);
+
+
+/*
+ * Resize memory allocated from an arena. If ptr was the most recent
+ * allocation and there is room, it is grown in place; otherwise the
+ * contents are copied to a new allocation.
+ *
+ * Parameters:
+ *   arena     The arena
+ *   ptr       The memory, or NULL to allocate afresh
+ *   old_size  The size ptr was allocated with
+ *   new_size  The size needed
+ * 
+ * Returns: The resized memory
+ */
+void *AR_realloc(Arena arena, void *ptr, size_t old_size, size_t new_size);
+
+
+/*
+ * Copy len bytes into an arena, adding a terminating nul
+ *
+ * Parameters:
+ *   arena    The arena
+ *   str      The bytes to copy
+ *   len      The number of bytes
+ * 
+ * Returns: The nul-terminated copy
+ */
+char *AR_strndup(Arena arena, const char *str, size_t len);
+
+
+/*
+ * Release everything allocated from an arena at once. This takes
+ * constant time: the arena's blocks are kept for reuse, unless an
+ * unusually large command has left it holding a lot of memory.
+ *
+ * Parameters:
+ *   arena    The arena
+ * 
+ * Returns: None
+ */
+void AR_reset(Arena arena);
+
+#endif /* _ARENA_H_ */
@@ -0,0 +1,595 @@
+/*
+ * bench.c
+ *
+ * Microbenchmarks for the tokenizer, the highlighter and the list
+ * primitives. Built
+ * without AddressSanitizer by "make bench".
+ *
+ * Each benchmark is timed over many samples, each sample running the
+ * operation enough times to take about SAMPLE_NS. Results are printed
+ * as one tab-separated line per benchmark, so runs of different
+ * versions can be compared with standard tools:
+ *
+ *   bench  param  unit  median  p99
+ *
+ * For times, p99 is the 99th percentile; for rates (MB/s, tokens/s)
+ * it is the 1st percentile, so in both cases it describes the slowest
+ * 1% of samples.
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "clist.h"
+#include "Tokenize.h"
+
+#ifndef BENCH_VERSION
+#define BENCH_VERSION "unknown"
+#endif
+
+// Default number of samples per benchmark
+#define DEFAULT_SAMPLES 200
+
+// Target duration of one sample
+#define SAMPLE_NS 200000.0
+
+// Longest generated command line
+#define CORPUS_MAX (256 * 1024)
+
+// Defeats dead-code elimination of benchmarked results
+static volatile size_t sink;
+
+static int nsamples = DEFAULT_SAMPLES;
+static const char *filter = NULL;
+
+
+/*
+ * Reads the monotonic clock
+ *
+ * Parameters: None
+ *
+ * Returns: The time in nanoseconds
+ */
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+// qsort comparison for doubles
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+
+/*
+ * Returns a percentile of a set of samples, sorting them in place
+ *
+ * Parameters:
+ *   samples  The samples
+ *   n        The number of samples
+ *   pct      The percentile, from 0 to 100
+ *
+ * Returns: The sample at that percentile
+ */
+static double percentile(double *samples, int n, double pct)
+{
+    qsort(samples, n, sizeof(double), compare_double);
+
+    int i = (int) (pct / 100.0 * (n - 1) + 0.5);
+    return samples[i];
+}
+
+
+/*
+ * Prints one result line
+ *
+ * Parameters:
+ *   name     The benchmark
+ *   param    What it was run on
+ *   unit     The unit of the samples
+ *   samples  The samples, which are sorted
+ *   higher   Whether higher values are better (a rate, not a time)
+ *
+ * Returns: None
+ */
+static void report(const char *name, const char *param, const char *unit,
+                   double *samples, bool higher)
+{
+    double median = percentile(samples, nsamples, 50);
+    double p99 = percentile(samples, nsamples, higher ? 1 : 99);
+
+    printf("%s\t%s\t%s\t%.2f\t%.2f\n", name, param, unit, median, p99);
+    fflush(stdout);
+}
+
+
+/*
+ * Checks whether a benchmark was selected on the command line
+ *
+ * Parameters:
+ *   name     The benchmark
+ *
+ * Returns: true if it should run
+ */
+static bool selected(const char *name)
+{
+    return filter == NULL || strstr(name, filter) != NULL;
+}
+
+
+/*
+ * Tokenizer benchmarks
+ */
+
+// A named command line to tokenize
+typedef struct
+{
+    const char *name;
+    char *text;
+} CorpusEntry;
+
+
+/*
+ * Builds a command line by repeating a piece of text
+ *
+ * Parameters:
+ *   prefix   Text to start with
+ *   piece    Text to repeat
+ *   suffix   Text to end with
+ *   size     Approximate length wanted
+ *
+ * Returns: The malloc'd command line
+ */
+static char *repeat(const char *prefix, const char *piece, const char *suffix, size_t size)
+{
+    size_t plen = strlen(prefix), len = strlen(piece), slen = strlen(suffix);
+    char *text = malloc(plen + size + len + slen + 1);
+    assert(text);
+
+    char *p = text;
+    memcpy(p, prefix, plen);
+    p += plen;
+    while ((size_t) (p - text) < size)
+    {
+        memcpy(p, piece, len);
+        p += len;
+    }
+    memcpy(p, suffix, slen + 1);
+
+    return text;
+}
+
+
+/*
+ * Times tokenizing one command line
+ *
+ * Parameters:
+ *   entry    The command line
+ *   arena    Arena for the tokens, reset after each run
+ *
+ * Returns: None
+ */
+static void bench_tokenize(const CorpusEntry *entry, Arena arena)
+{
+    char errmsg[256];
+    size_t len = strlen(entry->text);
+
+    // Count the tokens, and check the line is valid
+    CList tokens = TOK_tokenize_input(entry->text, arena, errmsg, sizeof(errmsg));
+    if (tokens == NULL)
+    {
+        fprintf(stderr, "bench: %s: %s\n", entry->name, errmsg);
+        exit(1);
+    }
+    int ntokens = CL_length(tokens);
+    AR_reset(arena);
+
+    // Size each sample from a rough first measurement
+    double start = now_ns();
+    TOK_tokenize_input(entry->text, arena, errmsg, sizeof(errmsg));
+    AR_reset(arena);
+    double once = now_ns() - start;
+    int iters = once > 0 ? (int) (SAMPLE_NS / once) + 1 : 1000;
+
+    double *mbps = malloc(nsamples * sizeof(double));
+    double *tps = malloc(nsamples * sizeof(double));
+    assert(mbps && tps);
+
+    for (int s = 0; s < nsamples; s++)
+    {
+        start = now_ns();
+        for (int i = 0; i < iters; i++)
+        {
+            tokens = TOK_tokenize_input(entry->text, arena, errmsg, sizeof(errmsg));
+            sink += CL_length(tokens);
+            AR_reset(arena);
+        }
+        double seconds = (now_ns() - start) / 1e9;
+
+        mbps[s] = (double) len * iters / seconds / 1e6;
+        tps[s] = (double) ntokens * iters / seconds;
+    }
+
+    report("tokenize", entry->name, "MB/s", mbps, true);
+    report("tokenize", entry->name, "tokens/s", tps, true);
+
+    free(mbps);
+    free(tps);
+}
+
+
+/*
+ * Runs the tokenizer benchmarks over a corpus of realistic and
+ * adversarial command lines
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+static void bench_tokenizer(void)
+{
+    if (!selected("tokenize"))
+        return;
+
+    CorpusEntry corpus[] = {
+        {"short", strdup("ls -l")},
+        {"typical", strdup("grep -v \"^#\" < /etc/services | sort | uniq -c > counts.txt")},
+        {"build", strdup("gcc -Wall -Werror -g -O2 -c Tokenize.c -o Tokenize.o -I. -DNDEBUG")},
+        {"long_quote", repeat("echo \"", "the quick brown fox jumps over the lazy dog ",
+                              "\"", CORPUS_MAX)},
+        {"long_word", repeat("echo ", "abcdefghijklmnopqrstuvwxyz0123456789", "", CORPUS_MAX)},
+        {"many_words", repeat("echo", " a bc def", "", CORPUS_MAX)},
+        {"many_pipes", repeat("cat file", " | tr a b", " > out", CORPUS_MAX)},
+        {"escapes", repeat("echo ", "\\t\\n\\\\\\ \\|\\<\\>", "", CORPUS_MAX)},
+        {"quoted_escapes", repeat("echo \"", "a\\\"b\\tc\\\\d\\ne", "\"", CORPUS_MAX)},
+    };
+    int ncorpus = sizeof(corpus) / sizeof(corpus[0]);
+
+    Arena arena = AR_new();
+
+    for (int i = 0; i < ncorpus; i++)
+    {
+        bench_tokenize(&corpus[i], arena);
+        free(corpus[i].text);
+    }
+
+    AR_free(arena);
+}
+
+
+/*
+ * Highlighter benchmarks: the time to highlight a long line again
+ * after typing one character, at its end or in its middle
+ */
+
+/*
+ * Times highlighting after a keystroke at one place in a line
+ *
+ * Parameters:
+ *   name     The name of the place
+ *   line     The line, with room for one more character
+ *   len      The length of the line
+ *   pos      Where the character is typed
+ *
+ * Returns: None
+ */
+static void bench_keystroke(const char *name, char *line, size_t len, size_t pos)
+{
+    TokHighlighter hl = TOK_highlighter_new();
+    const TokSpan *spans;
+    size_t changed;
+    double *samples = malloc(nsamples * sizeof(double));
+    assert(samples);
+
+    // Alternately type and delete the character, so each run is an edit
+    char *edited = malloc(len + 1);
+    assert(edited);
+    memcpy(edited, line, pos);
+    edited[pos] = 'x';
+    memcpy(&edited[pos + 1], &line[pos], len - pos);
+
+    TOK_highlight(hl, line, len, &spans, &changed);
+
+    for (int s = 0; s < nsamples; s++)
+    {
+        int iters = 100;
+        double start = now_ns();
+        for (int i = 0; i < iters; i++)
+        {
+            sink += TOK_highlight(hl, edited, len + 1, &spans, &changed);
+            sink += TOK_highlight(hl, line, len, &spans, &changed);
+        }
+        samples[s] = (now_ns() - start) / (2 * iters) / 1000;
+    }
+
+    char param[64];
+    snprintf(param, sizeof(param), "%s,%zuB", name, len);
+    report("highlight", param, "us/key", samples, false);
+
+    TOK_highlighter_free(hl);
+    free(edited);
+    free(samples);
+}
+
+
+/*
+ * Runs the highlighter benchmarks on a long pasted command line
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+static void bench_highlighter(void)
+{
+    if (!selected("highlight"))
+        return;
+
+    char *line = repeat("cat file", " | grep -v \"a b\" | tr a b", " > out", 8 * 1024);
+    size_t len = strlen(line);
+
+    bench_keystroke("end", line, len, len);
+    bench_keystroke("middle", line, len, len / 2);
+
+    free(line);
+}
+
+
+/*
+ * List benchmarks. Each is run at a range of sizes, and reports the
+ * time per element operation.
+ */
+
+// Sizes of list to benchmark
+static const int list_sizes[] = {10, 100, 1000, 10000, 100000};
+
+// The kinds of list benchmark
+typedef enum
+{
+    LIST_APPEND,     // Append n elements to an empty list
+    LIST_NTH,        // Look up n positions in a list of n
+    LIST_POP,        // Pop all n elements of a list
+    LIST_ITER,       // Walk a list of n with an iterator
+    LIST_COPY,       // Copy a list of n
+    LIST_MUT_REMOVE  // Remove every other element of a list of n in one walk
+} ListOp;
+
+static const char *list_op_names[] = {
+    [LIST_APPEND] = "CL_append",
+    [LIST_NTH] = "CL_nth",
+    [LIST_POP] = "CL_pop",
+    [LIST_ITER] = "CL_iter",
+    [LIST_COPY] = "CL_copy",
+    [LIST_MUT_REMOVE] = "CL_mut_remove",
+};
+
+
+/*
+ * Builds a list of n tokens
+ *
+ * Parameters:
+ *   n        The length of the list
+ *
+ * Returns: The new list
+ */
+static CList make_list(int n)
+{
+    CList list = CL_new();
+
+    for (int i = 0; i < n; i++)
+        CL_append(list, (Token){TOK_WORD, false, "x", (size_t) i});
+
+    return list;
+}
+
+
+/*
+ * Builds a list of n tokens that wraps around the end of its buffer,
+ * as a queue's does
+ *
+ * Parameters:
+ *   n        The length of the list
+ *
+ * Returns: The new list
+ */
+static CList make_wrapped_list(int n)
+{
+    CList list = CL_new();
+
+    for (int i = n / 2 - 1; i >= 0; i--)
+        CL_push(list, (Token){TOK_WORD, false, "x", (size_t) i});
+    for (int i = n / 2; i < n; i++)
+        CL_append(list, (Token){TOK_WORD, false, "x", (size_t) i});
+
+    return list;
+}
+
+
+/*
+ * Checks that a list holds just the odd elements of one from
+ * make_wrapped_list, in order, and exits if not
+ *
+ * Parameters:
+ *   list     The list
+ *   n        The length of the list it was made as
+ *
+ * Returns: None
+ */
+static void check_odd_elements(CList list, int n)
+{
+    bool ok = (CL_length(list) == n / 2);
+
+    for (int i = 0; ok && i < n / 2; i++)
+        ok = (CL_nth(list, i).len == (size_t) (2 * i + 1));
+
+    if (!ok)
+    {
+        fprintf(stderr, "bench: CL_mut_remove: wrong elements left, n=%d\n", n);
+        exit(1);
+    }
+}
+
+
+/*
+ * Runs one list operation over a list of n elements once
+ *
+ * Parameters:
+ *   op       The operation
+ *   n        The length of the list
+ *   list     A list of n elements, for the operations that read one
+ *
+ * Returns: The time taken, in nanoseconds, excluding any setup
+ */
+static double run_list_op(ListOp op, int n, CList list)
+{
+    double start, elapsed;
+
+    switch (op)
+    {
+    case LIST_APPEND:
+        {
+            start = now_ns();
+            CList built = make_list(n);
+            elapsed = now_ns() - start;
+            CL_free(built);
+            return elapsed;
+        }
+
+    case LIST_NTH:
+        start = now_ns();
+        // Stride through the list so the accesses are not sequential
+        for (int i = 0, pos = 0; i < n; i++, pos = (pos + 7919) % n)
+            sink += CL_nth(list, pos).len;
+        return now_ns() - start;
+
+    case LIST_POP:
+        {
+            CList popped = make_list(n);
+            start = now_ns();
+            for (int i = 0; i < n; i++)
+                sink += CL_pop(popped).len;
+            elapsed = now_ns() - start;
+            CL_free(popped);
+            return elapsed;
+        }
+
+    case LIST_ITER:
+        start = now_ns();
+        for (CL_iter it = CL_begin(list); !CL_done(&it); CL_next(&it))
+            sink += CL_current(&it)->len;
+        return now_ns() - start;
+
+    case LIST_COPY:
+        {
+            start = now_ns();
+            CList copy = CL_copy(list);
+            elapsed = now_ns() - start;
+            sink += CL_length(copy);
+            CL_free(copy);
+            return elapsed;
+        }
+
+    case LIST_MUT_REMOVE:
+        {
+            CList pruned = make_wrapped_list(n);
+            start = now_ns();
+            for (CL_mut_iter it = CL_mut_begin(pruned); !CL_mut_done(&it); )
+            {
+                if (CL_mut_current(&it)->len % 2 == 0)
+                    sink += CL_mut_remove(&it).len;
+                else
+                    CL_mut_next(&it);
+            }
+            elapsed = now_ns() - start;
+            check_odd_elements(pruned, n);
+            CL_free(pruned);
+            return elapsed;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Runs the list benchmarks at each size
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+static void bench_lists(void)
+{
+    double *samples = malloc(nsamples * sizeof(double));
+    assert(samples);
+
+    for (ListOp op = LIST_APPEND; op <= LIST_MUT_REMOVE; op++)
+    {
+        if (!selected(list_op_names[op]))
+            continue;
+
+        for (size_t s = 0; s < sizeof(list_sizes) / sizeof(list_sizes[0]); s++)
+        {
+            int n = list_sizes[s];
+            CList list = make_list(n);
+
+            double once = run_list_op(op, n, list);
+            int iters = once > 0 ? (int) (SAMPLE_NS / once) + 1 : 1000;
+
+            for (int i = 0; i < nsamples; i++)
+            {
+                double total = 0;
+                for (int j = 0; j < iters; j++)
+                    total += run_list_op(op, n, list);
+                samples[i] = total / iters / n;
+            }
+
+            char param[32];
+            snprintf(param, sizeof(param), "n=%d", n);
+            report(list_op_names[op], param, "ns/elem", samples, false);
+
+            CL_free(list);
+        }
+    }
+
+    free(samples);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        if (opt == 'n' && atoi(optarg) > 0)
+            nsamples = atoi(optarg);
+        else
+        {
+            fprintf(stderr, "usage: %s [-n samples] [benchmark]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind < argc)
+        filter = argv[optind];
+
+    printf("# plaidsh bench %s, %d samples\n", BENCH_VERSION, nsamples);
+    printf("# bench\tparam\tunit\tmedian\tp99\n");
+
+    bench_tokenizer();
+    bench_highlighter();
+    bench_lists();
+
+    return 0;
+}
@@ -0,0 +1,728 @@
+/*
+ * builtins.c
+ *
+ * Commands that the shell runs itself, without launching a process
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#define _GNU_SOURCE   // for copy_file_range and splice
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#include "builtins.h"
+#include "env.h"
+#include "executor.h"
+#include "histfile.h"
+#include "intern.h"
+#include "parallel.h"
+#include "pathcache.h"
+#include "stats.h"
+
+// Number of entries the history builtin lists by default
+#define HISTORY_SHOW 100
+
+// Largest request made to the kernel when copying data
+#define COPY_CHUNK (1024 * 1024)
+
+// Buffer size when the data has to pass through user space
+#define COPY_BUFFER (64 * 1024)
+
+// Separates the command of parallel from its inputs
+#define PARALLEL_INPUTS ":::"
+
+
+static int bi_author(int argc, char **argv, int in_fd, FILE *out)
+{
+    fprintf(out, "Pauline Uwase\n");
+    return 0;
+}
+
+
+static int bi_cd(int argc, char **argv, int in_fd, FILE *out)
+{
+    const char *home = EN_get("HOME");
+    char path[PATH_MAX];
+
+    if (argc > 2)
+    {
+        fprintf(stderr, "cd: too many arguments\n");
+        return 1;
+    }
+
+    if (argc == 1)
+        snprintf(path, sizeof(path), "%s", home ? home : "/");
+    else if (argv[1][0] == '~' && (argv[1][1] == '\0' || argv[1][1] == '/'))
+        snprintf(path, sizeof(path), "%s%s", home ? home : "", &argv[1][1]);
+    else
+        snprintf(path, sizeof(path), "%s", argv[1]);
+
+    if (chdir(path) < 0)
+    {
+        fprintf(stderr, "cd: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static int bi_pwd(int argc, char **argv, int in_fd, FILE *out)
+{
+    char cwd[PATH_MAX];
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+    {
+        fprintf(stderr, "pwd: %s\n", strerror(errno));
+        return 1;
+    }
+
+    fprintf(out, "%s\n", cwd);
+    return 0;
+}
+
+
+static int bi_echo(int argc, char **argv, int in_fd, FILE *out)
+{
+    int first = 1;
+    bool newline = true;
+
+    if (argc > 1 && strcmp(argv[1], "-n") == 0)
+    {
+        newline = false;
+        first = 2;
+    }
+
+    for (int i = first; i < argc; i++)
+    {
+        if (i > first)
+            fputc(' ', out);
+        fputs(argv[i], out);
+    }
+
+    if (newline)
+        fputc('\n', out);
+
+    return 0;
+}
+
+
+/*
+ * Copies everything from one descriptor to another. The kernel moves
+ * the data itself where it can: copy_file_range between regular files,
+ * splice when either end is a pipe, and sendfile from a regular file
+ * to anything else. Only if none of these applies, or the kernel
+ * refuses, does the data come through user space.
+ *
+ * Parameters:
+ *   in_fd    Where to read from, up to end-of-file
+ *   out_fd   Where to write to
+ * 
+ * Returns: 0 on success, or -1 with errno set
+ */
+static int copy_fd(int in_fd, int out_fd)
+{
+    struct stat in_st, out_st;
+
+    if (fstat(in_fd, &in_st) < 0 || fstat(out_fd, &out_st) < 0)
+        return -1;
+
+    bool in_file = S_ISREG(in_st.st_mode), out_file = S_ISREG(out_st.st_mode);
+    bool piped = S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode);
+
+    if (in_file || piped)
+    {
+        for (;;)
+        {
+            ssize_t n;
+
+            if (in_file && out_file)
+                n = copy_file_range(in_fd, NULL, out_fd, NULL, COPY_CHUNK, 0);
+            else if (piped)
+                n = splice(in_fd, NULL, out_fd, NULL, COPY_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+            else
+                n = sendfile(out_fd, in_fd, NULL, COPY_CHUNK);
+
+            if (n == 0)
+                return 0;
+            if (n > 0 || errno == EINTR)
+                continue;
+
+            // Unsupported for these files (an O_APPEND output, say, or
+            // a different filesystem); anything copied so far has moved
+            // both file offsets, so carry on the slow way
+            if (errno == EINVAL || errno == ENOSYS || errno == EXDEV ||
+                errno == EOPNOTSUPP || errno == EBADF)
+                break;
+
+            return -1;
+        }
+    }
+
+    char *buf = malloc(COPY_BUFFER);
+    if (buf == NULL)
+        return -1;
+
+    ssize_t n;
+    while ((n = read(in_fd, buf, COPY_BUFFER)) != 0)
+    {
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            free(buf);
+            return -1;
+        }
+
+        for (ssize_t done = 0; done < n; )
+        {
+            ssize_t w = write(out_fd, buf + done, n - done);
+            if (w < 0 && errno != EINTR)
+            {
+                free(buf);
+                return -1;
+            }
+            if (w > 0)
+                done += w;
+        }
+    }
+
+    free(buf);
+    return 0;
+}
+
+
+// Builtin cat handles only plain file operands; options go to the real one
+static bool cat_accepts(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+        if (argv[i][0] == '-' && argv[i][1] != '\0')
+            return false;
+
+    return true;
+}
+
+
+static int bi_cat(int argc, char **argv, int in_fd, FILE *out)
+{
+    int status = 0;
+
+    // The data bypasses out, so anything already buffered goes first
+    fflush(out);
+    int out_fd = fileno(out);
+
+    for (int i = 1; i < argc || i == 1; i++)
+    {
+        const char *name = (i < argc) ? argv[i] : "-";
+        int fd = in_fd;
+
+        if (strcmp(name, "-") != 0 && (fd = open(name, O_RDONLY | O_CLOEXEC)) < 0)
+        {
+            fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+            status = 1;
+            continue;
+        }
+
+        // Reads and writes fail differently, so tell them apart
+        int err = copy_fd(fd, out_fd) < 0 ? errno : 0;
+
+        if (fd != in_fd)
+            close(fd);
+
+        if (err == EPIPE)
+            return 1;     // the reader has gone; stop quietly
+        if (err != 0)
+        {
+            fprintf(stderr, "cat: %s: %s\n", name, strerror(err));
+            status = 1;
+        }
+    }
+
+    return status;
+}
+
+
+/*
+ * Writes the character for a backslash escape in a printf format
+ *
+ * Parameters:
+ *   c        The character after the backslash
+ *   out      Where to write
+ * 
+ * Returns: None
+ */
+static void printf_escape(char c, FILE *out)
+{
+    switch (c)
+    {
+    case 'n':  fputc('\n', out); break;
+    case 't':  fputc('\t', out); break;
+    case 'r':  fputc('\r', out); break;
+    case 'a':  fputc('\a', out); break;
+    case '\\': fputc('\\', out); break;
+    default:
+        fputc('\\', out);
+        fputc(c, out);
+    }
+}
+
+
+static int bi_printf(int argc, char **argv, int in_fd, FILE *out)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: printf format [arguments]\n");
+        return 2;
+    }
+
+    const char *format = argv[1];
+    char **args = &argv[2];
+    int nargs = argc - 2;
+    int status = 0;
+
+    // As in other shells, the format is reused until the arguments run out
+    do
+    {
+        int used = 0;
+
+        for (const char *p = format; *p; p++)
+        {
+            if (*p == '\\' && p[1] != '\0')
+            {
+                printf_escape(*++p, out);
+                continue;
+            }
+
+            if (*p != '%')
+            {
+                fputc(*p, out);
+                continue;
+            }
+
+            if (p[1] == '%')
+            {
+                fputc('%', out);
+                p++;
+                continue;
+            }
+
+            // Copy the conversion spec: flags, width and precision
+            char spec[32];
+            size_t n = strspn(p + 1, "-+ #0123456789.");
+            if (n + 4 > sizeof(spec) || p[1 + n] == '\0')
+            {
+                fprintf(stderr, "printf: invalid format\n");
+                return 1;
+            }
+            char conv = p[1 + n];
+            const char *arg = (used < nargs) ? args[used++] : NULL;
+            char *end = NULL;
+
+            memcpy(spec, p, n + 1);
+            p += n + 1;
+
+            switch (conv)
+            {
+            case 's':
+                strcpy(&spec[n + 1], "s");
+                fprintf(out, spec, arg ? arg : "");
+                break;
+            case 'c':
+                strcpy(&spec[n + 1], "c");
+                fprintf(out, spec, arg ? arg[0] : '\0');
+                break;
+            case 'd':
+            case 'i':
+                snprintf(&spec[n + 1], 4, "ll%c", conv);
+                fprintf(out, spec, arg ? strtoll(arg, &end, 0) : 0LL);
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                snprintf(&spec[n + 1], 4, "ll%c", conv);
+                fprintf(out, spec, arg ? strtoull(arg, &end, 0) : 0ULL);
+                break;
+            case 'e':
+            case 'f':
+            case 'g':
+                snprintf(&spec[n + 1], 2, "%c", conv);
+                fprintf(out, spec, arg ? strtod(arg, &end) : 0.0);
+                break;
+            default:
+                fprintf(stderr, "printf: %%%c: invalid conversion\n", conv);
+                return 1;
+            }
+
+            if (end != NULL && *end != '\0')
+            {
+                fprintf(stderr, "printf: %s: invalid number\n", arg);
+                status = 1;
+            }
+        }
+
+        if (used == 0)
+            break;     // the format takes no arguments
+        args += used;
+        nargs -= used;
+    } while (nargs > 0);
+
+    return status;
+}
+
+
+static int bi_true(int argc, char **argv, int in_fd, FILE *out)
+{
+    return 0;
+}
+
+
+static int bi_false(int argc, char **argv, int in_fd, FILE *out)
+{
+    return 1;
+}
+
+
+static int bi_hash(int argc, char **argv, int in_fd, FILE *out)
+{
+    if (argc == 1)
+    {
+        PC_print(out);
+        return 0;
+    }
+
+    if (argc == 2 && strcmp(argv[1], "-r") == 0)
+    {
+        PC_clear();
+        return 0;
+    }
+
+    fprintf(stderr, "usage: hash [-r]\n");
+    return 2;
+}
+
+
+static int bi_export(int argc, char **argv, int in_fd, FILE *out)
+{
+    int status = 0;
+
+    if (argc == 1)
+    {
+        EN_print(out);
+        return 0;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *eq = strchr(argv[i], '=');
+        size_t name_len = eq ? (size_t) (eq - argv[i]) : strlen(argv[i]);
+
+        if (!EN_valid_name(argv[i], name_len))
+        {
+            fprintf(stderr, "export: %.*s: not a valid name\n", (int) name_len, argv[i]);
+            status = 1;
+            continue;
+        }
+
+        // Every variable is exported already; there is nothing to do
+        // for a name without a value
+        if (eq)
+        {
+            argv[i][name_len] = '\0';
+            EN_set(argv[i], eq + 1);
+            argv[i][name_len] = '=';
+        }
+    }
+
+    return status;
+}
+
+
+static int bi_unset(int argc, char **argv, int in_fd, FILE *out)
+{
+    for (int i = 1; i < argc; i++)
+        EN_unset(argv[i]);
+
+    return 0;
+}
+
+
+// HF_callback for the history builtin: prints an entry to a stream
+static void print_entry(const char *line, size_t len, void *cb_data)
+{
+    fprintf((FILE *) cb_data, "%.*s\n", (int) len, line);
+}
+
+
+static int bi_history(int argc, char **argv, int in_fd, FILE *out)
+{
+    if (argc == 1)
+        HF_tail(HISTORY_SHOW, print_entry, out);
+    else if (argc == 2)
+        return HF_search(argv[1], print_entry, out) > 0 ? 0 : 1;
+    else
+    {
+        fprintf(stderr, "usage: history [text]\n");
+        return 2;
+    }
+
+    return 0;
+}
+
+
+static int bi_jobs(int argc, char **argv, int in_fd, FILE *out)
+{
+    if (argc > 1)
+    {
+        fprintf(stderr, "usage: jobs\n");
+        return 2;
+    }
+
+    EX_jobs(out);
+    return 0;
+}
+
+
+static int bi_wait(int argc, char **argv, int in_fd, FILE *out)
+{
+    if (argc == 1)
+        return EX_wait(0);
+
+    int status = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        char *end;
+        long id = (argv[i][0] == '%') ? strtol(&argv[i][1], &end, 10) : 0;
+
+        if (id <= 0 || *end != '\0')
+        {
+            fprintf(stderr, "usage: wait [%%job ...]\n");
+            return 2;
+        }
+
+        if ((status = EX_wait(id)) < 0)
+        {
+            fprintf(stderr, "wait: %s: no such job\n", argv[i]);
+            status = 127;
+        }
+    }
+
+    return status;
+}
+
+
+/*
+ * Reads the lines of a file descriptor, for the inputs of parallel.
+ * Empty lines are skipped.
+ *
+ * Parameters:
+ *   fd       The descriptor
+ *   lines    Return space for the malloc'd array of lines, which
+ *            point into *data
+ *   data     Return space for the malloc'd text read
+ * 
+ * Returns: The number of lines, or -1 on error
+ */
+static int read_lines(int fd, char ***lines, char **data)
+{
+    size_t len = 0, size = COPY_BUFFER;
+    char *text = malloc(size + 1);
+    ssize_t got;
+
+    assert(text);
+    while ((got = read(fd, text + len, size - len)) != 0)
+    {
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0)
+        {
+            free(text);
+            return -1;
+        }
+
+        len += got;
+        if (len == size)
+        {
+            size *= 2;
+            text = realloc(text, size + 1);
+            assert(text);
+        }
+    }
+    text[len] = '\0';
+
+    int n = 0;
+    for (size_t i = 0; i < len; i++)
+        n += (text[i] == '\n');
+
+    char **array = malloc((n + 1) * sizeof(char *));
+    assert(array);
+
+    n = 0;
+    for (char *line = strtok(text, "\n"); line != NULL; line = strtok(NULL, "\n"))
+        array[n++] = line;
+
+    *lines = array;
+    *data = text;
+    return n;
+}
+
+
+static int bi_parallel(int argc, char **argv, int in_fd, FILE *out)
+{
+    long njobs = sysconf(_SC_NPROCESSORS_ONLN);
+    bool keep_order = false, usage = false;
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-'; i++)
+    {
+        char *value = NULL, *end;
+
+        if (strcmp(argv[i], "-k") == 0)
+            keep_order = true;
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            value = argv[++i];
+        else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2] != '\0')
+            value = &argv[i][2];
+        else
+            usage = true;
+
+        if (value != NULL && ((njobs = strtol(value, &end, 10)) <= 0 || *end != '\0'))
+            usage = true;
+        if (usage)
+            break;
+    }
+
+    int ntemplate = 0;
+    while (i + ntemplate < argc && strcmp(argv[i + ntemplate], PARALLEL_INPUTS) != 0)
+        ntemplate++;
+
+    if (usage || ntemplate == 0)
+    {
+        fprintf(stderr, "usage: parallel [-k] [-j jobs] command [arg ...] [::: input ...]\n");
+        return 2;
+    }
+
+    if (njobs <= 0)
+        njobs = 1;   // the number of processors is unknown
+
+    // The inputs follow :::, or are the lines of standard input
+    int first_input = i + ntemplate + 1;
+    if (first_input <= argc)
+        return PA_run(&argv[i], ntemplate, &argv[first_input], argc - first_input,
+                      njobs, keep_order, out);
+
+    char **lines, *data;
+    int nlines = read_lines(in_fd, &lines, &data);
+    if (nlines < 0)
+    {
+        fprintf(stderr, "parallel: %s\n", strerror(errno));
+        return 1;
+    }
+
+    int status = PA_run(&argv[i], ntemplate, lines, nlines, njobs, keep_order, out);
+    free(lines);
+    free(data);
+
+    return status;
+}
+
+
+static int bi_stats(int argc, char **argv, int in_fd, FILE *out)
+{
+    if (argc == 1)
+    {
+        ST_print(out);
+        return 0;
+    }
+
+    if (argc == 2 && strcmp(argv[1], "on") == 0)
+        ST_enable(true);
+    else if (argc == 2 && strcmp(argv[1], "off") == 0)
+        ST_enable(false);
+    else if (argc == 2 && strcmp(argv[1], "reset") == 0)
+        ST_reset();
+    else
+    {
+        fprintf(stderr, "usage: stats [on | off | reset]\n");
+        return 2;
+    }
+
+    return 0;
+}
+
+
+static const Builtin builtins[] = {
+    {"author", bi_author, false},
+    {"cat",    bi_cat,    false, cat_accepts},
+    {"cd",     bi_cd,     true},
+    {"echo",   bi_echo,   false},
+    {"export", bi_export, true},
+    {"false",  bi_false,  false},
+    {"hash",   bi_hash,   false},
+    {"history", bi_history, false},
+    {"jobs",   bi_jobs,   true},    // the job list belongs to the main thread
+    {"parallel", bi_parallel, false},
+    {"printf", bi_printf, false},
+    {"pwd",    bi_pwd,    false},
+    {"stats",  bi_stats,  false},
+    {"true",   bi_true,   false},
+    {"unset",  bi_unset,  true},
+    {"wait",   bi_wait,   true},
+};
+
+#define NBUILTINS (sizeof(builtins) / sizeof(builtins[0]))
+
+// The interned name of each builtin, for lookups by pointer
+static const char *builtin_names[NBUILTINS];
+static pthread_once_t names_once = PTHREAD_ONCE_INIT;
+
+
+// pthread_once routine: interns the builtin names
+static void intern_names(void)
+{
+    for (size_t i = 0; i < NBUILTINS; i++)
+        builtin_names[i] = IN_intern(builtins[i].name, strlen(builtins[i].name));
+}
+
+
+// Documented in .h file
+const Builtin *BI_lookup(const char *name)
+{
+    pthread_once(&names_once, intern_names);
+
+    for (size_t i = 0; i < NBUILTINS; i++)
+        if (builtin_names[i] == name)
+            return &builtins[i];
+
+    return NULL;
+}
+
+
+// Documented in .h file
+const Builtin *BI_for_command(const Command *cmd)
+{
+    const Builtin *builtin = BI_lookup(cmd->name);
+
+    if (builtin != NULL && builtin->accepts != NULL && !builtin->accepts(cmd->argc, cmd->argv))
+        return NULL;
+
+    return builtin;
+}
+
+
+// Documented in .h file
+const Builtin *BI_all(size_t *count)
+{
+    *count = NBUILTINS;
+    return builtins;
+}
@@ -0,0 +1,76 @@
+/*
+ * builtins.h
+ *
+ * Commands that the shell runs itself, without launching a process
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#ifndef _BUILTINS_H_
+#define _BUILTINS_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "pipeline.h"
+
+/*
+ * The signature of a builtin command. A builtin that is a pipeline
+ * stage may run on its own thread, so it must only use in and out for
+ * its standard input and output (stderr is shared with the shell).
+ *
+ * Parameters:
+ *   argc     Number of arguments, including the command name
+ *   argv     The arguments, followed by NULL
+ *   in_fd    File descriptor for the command's standard input
+ *   out      Stream for the command's standard output
+ * 
+ * Returns: The command's exit status
+ */
+typedef int (*builtin_fn)(int argc, char **argv, int in_fd, FILE *out);
+
+typedef struct
+{
+    const char *name;
+    builtin_fn fn;
+    bool shell_only;   // Changes shell state, so cannot be a pipeline stage
+    bool (*accepts)(int argc, char **argv);   // Whether the builtin handles
+                                              //   these arguments, or NULL
+                                              //   if it handles any
+} Builtin;
+
+
+/*
+ * Find the builtin with the given name
+ *
+ * Parameters:
+ *   name     The command name, interned (see intern.h)
+ * 
+ * Returns: The builtin, or NULL if name is not a builtin
+ */
+const Builtin *BI_lookup(const char *name);
+
+
+/*
+ * Find the builtin that should run a command. A builtin may handle
+ * only some uses of its name (cat without options, for example), in
+ * which case the others run the program of that name instead.
+ *
+ * Parameters:
+ *   cmd      The command
+ * 
+ * Returns: The builtin, or NULL if the command is not run by a builtin
+ */
+const Builtin *BI_for_command(const Command *cmd);
+
+
+/*
+ * Get the table of every builtin, in alphabetical order
+ *
+ * Parameters:
+ *   count    Return space for the number of builtins
+ * 
+ * Returns: The table
+ */
+const Builtin *BI_all(size_t *count);
+
+#endif /* _BUILTINS_H_ */
@@ -0,0 +1,785 @@
+/*
+ * complete.c
+ *
+ * Find completions for command names and filenames.
+ *
+ * The names in each directory that has been completed in are kept in
+ * a prefix trie, read the first time they are needed, so finding the
+ * completions of a prefix costs a walk down the trie for the prefix
+ * and then one step per byte of the completions, however big the
+ * directory is. Every directory of $PATH gets a trie of its
+ * executables; other directories are kept for the most recent
+ * CO_MAX_DIRS used.
+ *
+ * Each cached directory is watched with inotify. Before any lookup,
+ * the pending events are applied to the tries, one name at a time, so
+ * a directory is only read again if its watch is lost. Where inotify
+ * is not available, a directory is read again whenever its
+ * modification time changes.
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "complete.h"
+#include "builtins.h"
+#include "env.h"
+
+// Most directories other than those of $PATH to keep
+#define CO_MAX_DIRS 32
+
+// Search path used when $PATH is not set
+#define CO_DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+
+// Changes to a directory that are applied to its trie
+#define CO_ENTRY_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB)
+
+// Changes that make the whole trie invalid
+#define CO_DIR_EVENTS (IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT | IN_IGNORED)
+
+// One node of a trie. Node 0 is the root; 0 is also used for "none",
+// as the root is nobody's child or sibling.
+typedef struct
+{
+    uint32_t child;           // First child
+    uint32_t next;            // Next sibling
+    unsigned char c;          // The byte leading here from the parent
+    bool terminal;            // Whether a name ends here
+} TrieNode;
+
+typedef struct
+{
+    TrieNode *nodes;
+    uint32_t nnodes;
+    uint32_t cap;
+    uint32_t nnames;          // Names in the trie
+    uint32_t nremoved;        // Names removed since it was built
+} Trie;
+
+// The names in one directory
+typedef struct dir_cache
+{
+    char *path;
+    bool commands;            // Holds only executables, for $PATH
+    bool pinned;              // A directory of $PATH, never evicted
+    bool valid;               // Whether trie matches the directory
+    int wd;                   // inotify watch, or -1
+    struct timespec mtime;    // Modification time, when not watched
+    uint64_t used;            // When last used, for eviction
+    Trie trie;
+    struct dir_cache *next;
+} DirCache;
+
+static struct
+{
+    bool initialized;
+    int inotify_fd;           // -1 if inotify is not available
+    DirCache *dirs;
+    int nunpinned;            // Number of dirs not in $PATH
+    uint64_t clock;
+    char *path_var;           // The $PATH that path_dirs was built from
+    DirCache **path_dirs;
+    int npath_dirs;
+} co;
+
+
+/*
+ * Empties a trie, keeping just the root
+ *
+ * Parameters:
+ *   trie     The trie
+ *
+ * Returns: None
+ */
+static void trie_clear(Trie *trie)
+{
+    if (trie->cap == 0)
+    {
+        trie->cap = 64;
+        trie->nodes = malloc(trie->cap * sizeof(TrieNode));
+        assert(trie->nodes);
+    }
+
+    memset(&trie->nodes[0], 0, sizeof(TrieNode));
+    trie->nnodes = 1;
+    trie->nnames = trie->nremoved = 0;
+}
+
+
+/*
+ * Finds the child of a node reached by a byte
+ *
+ * Parameters:
+ *   trie     The trie
+ *   node     The node
+ *   c        The byte
+ *
+ * Returns: The child, or 0 if there is none
+ */
+static uint32_t trie_child(const Trie *trie, uint32_t node, unsigned char c)
+{
+    for (uint32_t n = trie->nodes[node].child; n != 0; n = trie->nodes[n].next)
+        if (trie->nodes[n].c == c)
+            return n;
+
+    return 0;
+}
+
+
+/*
+ * Adds a name to a trie, if it is not already there
+ *
+ * Parameters:
+ *   trie     The trie
+ *   name     The name
+ *
+ * Returns: None
+ */
+static void trie_insert(Trie *trie, const char *name)
+{
+    uint32_t node = 0;
+
+    for (const unsigned char *p = (const unsigned char *) name; *p; p++)
+    {
+        uint32_t child = trie_child(trie, node, *p);
+
+        if (child == 0)
+        {
+            if (trie->nnodes == trie->cap)
+            {
+                trie->cap *= 2;
+                trie->nodes = realloc(trie->nodes, trie->cap * sizeof(TrieNode));
+                assert(trie->nodes);
+            }
+
+            child = trie->nnodes++;
+            trie->nodes[child] = (TrieNode){.child = 0, .next = trie->nodes[node].child,
+                                            .c = *p, .terminal = false};
+            trie->nodes[node].child = child;
+        }
+
+        node = child;
+    }
+
+    if (!trie->nodes[node].terminal)
+        trie->nnames++;
+    trie->nodes[node].terminal = true;
+}
+
+
+/*
+ * Finds the node for a prefix
+ *
+ * Parameters:
+ *   trie     The trie
+ *   prefix   The prefix
+ *
+ * Returns: The node, or 0 if no name starts with prefix (or prefix is
+ *   empty, in which case the root is the answer anyway)
+ */
+static uint32_t trie_find(const Trie *trie, const char *prefix)
+{
+    uint32_t node = 0;
+
+    for (const unsigned char *p = (const unsigned char *) prefix; *p; p++)
+    {
+        node = trie_child(trie, node, *p);
+        if (node == 0)
+            return 0;
+    }
+
+    return node;
+}
+
+
+/*
+ * Removes a name from a trie. Its nodes are left in place, to be
+ * reused if the name comes back, until the trie is next rebuilt; see
+ * trie_stale.
+ *
+ * Parameters:
+ *   trie     The trie
+ *   name     The name
+ *
+ * Returns: None
+ */
+static void trie_remove(Trie *trie, const char *name)
+{
+    uint32_t node = trie_find(trie, name);
+
+    if (node != 0 && trie->nodes[node].terminal)
+    {
+        trie->nodes[node].terminal = false;
+        trie->nnames--;
+        trie->nremoved++;
+    }
+}
+
+
+/*
+ * Checks whether a trie holds more dead nodes than it is worth walking
+ * past, so that it should be rebuilt: when more names have been removed
+ * from it than remain
+ *
+ * Parameters:
+ *   trie     The trie
+ *
+ * Returns: true if the trie should be rebuilt
+ */
+static bool trie_stale(const Trie *trie)
+{
+    return trie->nremoved > trie->nnames;
+}
+
+
+// The state of a walk over the names below a trie node
+typedef struct
+{
+    const Trie *trie;
+    char *buf;                // The directory, the prefix, then the name
+    size_t len;
+    size_t cap;
+    bool hidden;              // Whether to report names starting with "."
+    size_t name_start;        // Where the name starts in buf
+    CO_callback callback;
+    void *cb_data;
+    int count;
+} TrieWalk;
+
+
+/*
+ * Reports every name below a trie node
+ *
+ * Parameters:
+ *   walk     The walk, whose buffer holds the text leading to node
+ *   node     The node
+ *
+ * Returns: None
+ */
+static void trie_walk(TrieWalk *walk, uint32_t node)
+{
+    const TrieNode *n = &walk->trie->nodes[node];
+
+    if (n->terminal && (walk->hidden || walk->buf[walk->name_start] != '.'))
+    {
+        walk->callback(walk->buf, walk->cb_data);
+        walk->count++;
+    }
+
+    if (walk->len + 2 > walk->cap)
+    {
+        walk->cap *= 2;
+        walk->buf = realloc(walk->buf, walk->cap);
+        assert(walk->buf);
+    }
+
+    for (uint32_t child = n->child; child != 0; child = walk->trie->nodes[child].next)
+    {
+        walk->buf[walk->len++] = walk->trie->nodes[child].c;
+        walk->buf[walk->len] = '\0';
+        trie_walk(walk, child);
+        walk->buf[--walk->len] = '\0';
+    }
+}
+
+
+/*
+ * Reports the names in a trie that start with a prefix
+ *
+ * Parameters:
+ *   trie     The trie
+ *   dir      Text to put before each name
+ *   prefix   The prefix
+ *   callback Function to call for each name
+ *   cb_data  Caller data to pass to callback
+ *
+ * Returns: The number of names reported
+ */
+static int trie_complete(const Trie *trie, const char *dir, const char *prefix,
+                         CO_callback callback, void *cb_data)
+{
+    uint32_t node = trie_find(trie, prefix);
+
+    if (node == 0 && *prefix != '\0')
+        return 0;
+
+    size_t dir_len = strlen(dir), prefix_len = strlen(prefix);
+    TrieWalk walk = {
+        .trie = trie,
+        .len = dir_len + prefix_len,
+        .cap = dir_len + prefix_len + NAME_MAX + 2,
+        .hidden = (prefix[0] == '.'),
+        .name_start = dir_len,
+        .callback = callback,
+        .cb_data = cb_data,
+    };
+
+    walk.buf = malloc(walk.cap);
+    assert(walk.buf);
+    memcpy(walk.buf, dir, dir_len);
+    memcpy(&walk.buf[dir_len], prefix, prefix_len + 1);
+
+    trie_walk(&walk, node);
+
+    free(walk.buf);
+    return walk.count;
+}
+
+
+/*
+ * Checks whether a file is a command: an executable regular file
+ *
+ * Parameters:
+ *   dir_fd   The directory containing it
+ *   name     Its name
+ *
+ * Returns: true if it is a command
+ */
+static bool is_command(int dir_fd, const char *name)
+{
+    struct stat st;
+
+    return fstatat(dir_fd, name, &st, 0) == 0 && S_ISREG(st.st_mode) && (st.st_mode & 0111) != 0;
+}
+
+
+/*
+ * Reads a directory into its trie, and starts watching it
+ *
+ * Parameters:
+ *   dir      The directory
+ *
+ * Returns: None
+ */
+static void load_dir(DirCache *dir)
+{
+    trie_clear(&dir->trie);
+    dir->valid = true;
+
+    // Watch first, so that no change can be missed
+    if (dir->wd < 0 && co.inotify_fd >= 0)
+        dir->wd = inotify_add_watch(co.inotify_fd, dir->path,
+                                    CO_ENTRY_EVENTS | CO_DIR_EVENTS | IN_ONLYDIR);
+
+    struct stat st;
+    if (dir->wd < 0)
+    {
+        memset(&dir->mtime, 0, sizeof(dir->mtime));
+        if (stat(dir->path, &st) == 0)
+            dir->mtime = st.st_mtim;
+    }
+
+    DIR *d = opendir(dir->path);
+    if (d == NULL)
+        return;
+
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL)
+    {
+        const char *name = entry->d_name;
+
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+            continue;
+
+        if (dir->commands && (entry->d_type == DT_DIR || !is_command(dirfd(d), name)))
+            continue;
+
+        trie_insert(&dir->trie, name);
+    }
+
+    closedir(d);
+}
+
+
+/*
+ * Applies a change to one name in a directory to its trie
+ *
+ * Parameters:
+ *   dir      The directory
+ *   name     The name
+ *   mask     The inotify event
+ *
+ * Returns: None
+ */
+static void apply_event(DirCache *dir, const char *name, uint32_t mask)
+{
+    bool present = (mask & (IN_CREATE | IN_MOVED_TO | IN_ATTRIB)) != 0;
+
+    if (present && dir->commands)
+    {
+        int dir_fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        present = dir_fd >= 0 && is_command(dir_fd, name);
+        if (dir_fd >= 0)
+            close(dir_fd);
+    }
+
+    if (present)
+        trie_insert(&dir->trie, name);
+    else if (dir->commands || (mask & (IN_DELETE | IN_MOVED_FROM)))
+        trie_remove(&dir->trie, name);
+
+    // A directory with a lot of churn is read again, from scratch
+    if (trie_stale(&dir->trie))
+        dir->valid = false;
+}
+
+
+/*
+ * Forgets a watch whose directory has gone, been moved or been
+ * unmounted, so that every directory cached through it is read again,
+ * and watched again, from its path
+ *
+ * Parameters:
+ *   wd       The watch
+ *   mask     The inotify event
+ *
+ * Returns: None
+ */
+static void drop_watch(int wd, uint32_t mask)
+{
+    // After IN_IGNORED the kernel has already removed it
+    if (!(mask & IN_IGNORED))
+        inotify_rm_watch(co.inotify_fd, wd);
+
+    // The same directory may be cached twice, as commands and as
+    // files, sharing one watch
+    for (DirCache *dir = co.dirs; dir != NULL; dir = dir->next)
+    {
+        if (dir->wd == wd)
+        {
+            dir->wd = -1;
+            dir->valid = false;
+        }
+    }
+}
+
+
+/*
+ * Applies every pending inotify event to the tries
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+static void process_events(void)
+{
+    char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    if (co.inotify_fd < 0)
+        return;
+
+    while ((len = read(co.inotify_fd, buf, sizeof(buf))) > 0)
+    {
+        for (char *p = buf; p < buf + len; )
+        {
+            const struct inotify_event *event = (const struct inotify_event *) p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            // Handled even for a directory already marked invalid, as
+            // its watch must still go
+            if (event->mask & CO_DIR_EVENTS)
+            {
+                drop_watch(event->wd, event->mask);
+                continue;
+            }
+
+            for (DirCache *dir = co.dirs; dir != NULL; dir = dir->next)
+            {
+                if (event->mask & IN_Q_OVERFLOW)
+                    dir->valid = false;
+                if (dir->wd == event->wd && dir->valid && event->len > 0)
+                    apply_event(dir, event->name, event->mask);
+            }
+        }
+    }
+}
+
+
+/*
+ * Makes sure a cached directory is up to date, reading it if need be
+ *
+ * Parameters:
+ *   dir      The directory
+ *
+ * Returns: None
+ */
+static void refresh_dir(DirCache *dir)
+{
+    // Without a watch, fall back to the modification time
+    if (dir->valid && dir->wd < 0)
+    {
+        struct stat st;
+        struct timespec mtime = {0, 0};
+        if (stat(dir->path, &st) == 0)
+            mtime = st.st_mtim;
+        dir->valid = (mtime.tv_sec == dir->mtime.tv_sec && mtime.tv_nsec == dir->mtime.tv_nsec);
+    }
+
+    if (!dir->valid)
+        load_dir(dir);
+
+    dir->used = ++co.clock;
+}
+
+
+/*
+ * Frees a cached directory, removing it from the list
+ *
+ * Parameters:
+ *   dir      The directory
+ *
+ * Returns: None
+ */
+static void free_dir(DirCache *dir)
+{
+    bool shared = false;
+
+    for (DirCache **link = &co.dirs; *link != NULL; )
+    {
+        if (*link == dir)
+            *link = dir->next;
+        else
+        {
+            shared |= (dir->wd >= 0 && (*link)->wd == dir->wd);
+            link = &(*link)->next;
+        }
+    }
+
+    if (dir->wd >= 0 && !shared)
+        inotify_rm_watch(co.inotify_fd, dir->wd);
+    if (!dir->pinned)
+        co.nunpinned--;
+
+    free(dir->trie.nodes);
+    free(dir->path);
+    free(dir);
+}
+
+
+/*
+ * Finds a directory in the cache, adding it if it is not there, and
+ * brings it up to date. The least recently used directory is evicted
+ * if there are too many.
+ *
+ * Parameters:
+ *   path     The directory
+ *   commands Whether to keep only its executables
+ *   pinned   Whether it is a directory of $PATH
+ *
+ * Returns: The directory
+ */
+static DirCache *get_dir(const char *path, bool commands, bool pinned)
+{
+    DirCache *dir;
+
+    for (dir = co.dirs; dir != NULL; dir = dir->next)
+        if (dir->commands == commands && strcmp(dir->path, path) == 0)
+            break;
+
+    if (dir == NULL)
+    {
+        if (!pinned && co.nunpinned >= CO_MAX_DIRS)
+        {
+            DirCache *oldest = NULL;
+            for (DirCache *d = co.dirs; d != NULL; d = d->next)
+                if (!d->pinned && (oldest == NULL || d->used < oldest->used))
+                    oldest = d;
+            free_dir(oldest);
+        }
+
+        dir = calloc(1, sizeof(DirCache));
+        assert(dir);
+        dir->path = strdup(path);
+        assert(dir->path);
+        dir->commands = commands;
+        dir->pinned = pinned;
+        dir->wd = -1;
+        dir->next = co.dirs;
+        co.dirs = dir;
+        if (!pinned)
+            co.nunpinned++;
+    }
+
+    refresh_dir(dir);
+    return dir;
+}
+
+
+/*
+ * Sets up inotify, the first time a completion is wanted
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+static void init_completion(void)
+{
+    if (co.initialized)
+        return;
+
+    co.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    co.initialized = true;
+}
+
+
+/*
+ * Makes sure the directories of $PATH match the current $PATH
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+static void sync_path(void)
+{
+    const char *path_var = EN_get("PATH");
+    if (path_var == NULL)
+        path_var = CO_DEFAULT_PATH;
+
+    if (co.path_var != NULL && strcmp(co.path_var, path_var) == 0)
+        return;
+
+    // The old directories are forgotten
+    for (int i = 0; i < co.npath_dirs; i++)
+        free_dir(co.path_dirs[i]);
+    free(co.path_dirs);
+    free(co.path_var);
+
+    co.path_var = strdup(path_var);
+    assert(co.path_var);
+
+    int ndirs = 1;
+    for (const char *p = path_var; *p; p++)
+        if (*p == ':')
+            ndirs++;
+
+    co.path_dirs = calloc(ndirs, sizeof(DirCache *));
+    assert(co.path_dirs);
+    co.npath_dirs = 0;
+
+    for (const char *start = path_var; ; start++)
+    {
+        size_t len = strcspn(start, ":");
+
+        // Relative directories depend on the current directory, so
+        // are not kept
+        if (len > 0 && start[0] == '/')
+        {
+            char *path = strndup(start, len);
+            assert(path);
+
+            bool seen = false;
+            for (int i = 0; i < co.npath_dirs; i++)
+                seen |= (strcmp(co.path_dirs[i]->path, path) == 0);
+
+            if (!seen)
+            {
+                co.path_dirs[co.npath_dirs] = get_dir(path, true, true);
+                co.npath_dirs++;
+            }
+            free(path);
+        }
+
+        start += len;
+        if (*start == '\0')
+            break;
+    }
+}
+
+
+// Documented in .h file
+int CO_commands(const char *prefix, CO_callback callback, void *cb_data)
+{
+    assert(prefix && callback);
+    init_completion();
+    process_events();
+    sync_path();
+
+    int count = 0;
+
+    size_t nbuiltins;
+    const Builtin *builtins = BI_all(&nbuiltins);
+    for (size_t i = 0; i < nbuiltins; i++)
+    {
+        if (strncmp(builtins[i].name, prefix, strlen(prefix)) == 0)
+        {
+            callback(builtins[i].name, cb_data);
+            count++;
+        }
+    }
+
+    for (int i = 0; i < co.npath_dirs; i++)
+    {
+        refresh_dir(co.path_dirs[i]);
+        count += trie_complete(&co.path_dirs[i]->trie, "", prefix, callback, cb_data);
+    }
+
+    return count;
+}
+
+
+// Documented in .h file
+int CO_files(const char *prefix, CO_callback callback, void *cb_data)
+{
+    assert(prefix && callback);
+    init_completion();
+    process_events();
+
+    // Split the prefix into its directory and the start of the name
+    const char *slash = strrchr(prefix, '/');
+    size_t dir_len = slash ? (size_t) (slash - prefix + 1) : 0;
+    char dir_text[PATH_MAX], path[PATH_MAX];
+
+    if (dir_len >= sizeof(dir_text))
+        return 0;
+    memcpy(dir_text, prefix, dir_len);
+    dir_text[dir_len] = '\0';
+
+    // Relative directories are kept by their absolute path, so that
+    // they survive cd
+    if (dir_text[0] == '/')
+        snprintf(path, sizeof(path), "%s", dir_text);
+    else
+    {
+        char cwd[PATH_MAX];
+        if (getcwd(cwd, sizeof(cwd)) == NULL)
+            return 0;
+        if ((size_t) snprintf(path, sizeof(path), "%s/%s", cwd, dir_text) >= sizeof(path))
+            return 0;
+    }
+
+    // "/a/b/" and "/a/b" are the same directory
+    size_t path_len = strlen(path);
+    while (path_len > 1 && path[path_len - 1] == '/')
+        path[--path_len] = '\0';
+
+    DirCache *dir = get_dir(path, false, false);
+    return trie_complete(&dir->trie, dir_text, &prefix[dir_len], callback, cb_data);
+}
+
+
+// Documented in .h file
+void CO_clear(void)
+{
+    while (co.dirs != NULL)
+        free_dir(co.dirs);
+
+    free(co.path_dirs);
+    free(co.path_var);
+    co.path_dirs = NULL;
+    co.npath_dirs = 0;
+    co.path_var = NULL;
+}
@@ -0,0 +1,65 @@
+/*
+ * complete.h
+ *
+ * Find completions for command names and filenames, from prefix tries
+ * of directory contents that are kept up to date with inotify
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#ifndef _COMPLETE_H_
+#define _COMPLETE_H_
+
+#include <stddef.h>
+
+/*
+ * Called once for each completion found. The same completion may be
+ * reported more than once.
+ *
+ * Parameters:
+ *   match    The completion, valid only during the call
+ *   cb_data  Caller data
+ */
+typedef void (*CO_callback)(const char *match, void *cb_data);
+
+
+/*
+ * Find the commands whose names start with a prefix: the builtins and
+ * the executables in the directories of $PATH
+ *
+ * Parameters:
+ *   prefix   The start of the command name
+ *   callback Function to call for each completion
+ *   cb_data  Caller data to pass to callback
+ *
+ * Returns: The number of completions reported
+ */
+int CO_commands(const char *prefix, CO_callback callback, void *cb_data);
+
+
+/*
+ * Find the files whose names start with a prefix. The prefix may
+ * include a directory, relative or absolute, which each completion
+ * also starts with. Files whose names begin with a dot are only
+ * reported if the prefix's name does.
+ *
+ * Parameters:
+ *   prefix   The start of the filename
+ *   callback Function to call for each completion
+ *   cb_data  Caller data to pass to callback
+ *
+ * Returns: The number of completions reported
+ */
+int CO_files(const char *prefix, CO_callback callback, void *cb_data);
+
+
+/*
+ * Discard every cached directory and stop watching them
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+void CO_clear(void);
+
+#endif /* _COMPLETE_H_ */
@@ -0,0 +1,629 @@
+/*
+ * container.h
+ *
+ * Generators for containers specialized to one element type. Each
+ * macro stamps out a type and its functions, named with a prefix, so
+ * elements are stored and returned as themselves rather than through
+ * void pointers, and the operations on hot paths are inline.
+ *
+ *   RING_DECLARE / RING_DEFINE   A list in a growable ring buffer, for
+ *                                queues and token lists; see clist.h
+ *   VEC_DECLARE                  A growable array, embedded by value
+ *   ILIST_DECLARE                An intrusive doubly-linked list, for
+ *                                objects that are created one at a
+ *                                time and removed from the middle
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#ifndef _CONTAINER_H_
+#define _CONTAINER_H_
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "stats.h"
+
+
+/*
+ * Ring lists. RING_DECLARE(Ring, PFX, Elem, SENTINEL), in a header,
+ * declares the list type Ring, a pointer, and these functions:
+ *
+ *   Ring PFX_new(void)              A new, empty list
+ *   Ring PFX_new_in(Arena arena)    Likewise, allocated from arena
+ *                                   (or malloc, if NULL); freed with it
+ *   void PFX_free(Ring list)        Frees a malloc'd list; NULL is ignored
+ *   int  PFX_length(Ring list)
+ *   void PFX_push(list, element)    Adds element at the head
+ *   Elem PFX_pop(Ring list)         Removes the head, or returns the
+ *                                   sentinel if the list is empty
+ *   void PFX_append(list, element)  Adds element at the tail
+ *   Elem PFX_nth(list, pos)         The element at pos, counting from
+ *                                   the head from 0, or from the tail
+ *                                   from -1; the sentinel if there is none
+ *   Elem *PFX_at(list, pos)         The element at pos, in place, for
+ *                                   reading or changing without a copy;
+ *                                   NULL if there is none
+ *   bool PFX_insert(list, element, pos)  Inserts before pos, or after the
+ *                                   element at pos if it is negative
+ *   Elem PFX_remove(list, pos)      Removes and returns the element at pos
+ *   Ring PFX_copy(Ring list)        A copy, in the same arena
+ *   void PFX_join(list1, list2)     Moves the elements of list2 to the
+ *                                   end of list1
+ *   void PFX_reverse(Ring list)
+ *   void PFX_foreach(list, callback, cb_data)
+ *   Elem PFX_sentinel(void)         What PFX_pop and PFX_nth return for
+ *                                   a missing element
+ *
+ * and two iterators, which walk the list from head to tail inline,
+ * rather than through a callback:
+ *
+ *   for (PFX_iter it = PFX_begin(list); !PFX_done(&it); PFX_next(&it))
+ *       ... *PFX_current(&it), at position it.pos ...
+ *
+ *   for (PFX_mut_iter it = PFX_mut_begin(list); !PFX_mut_done(&it); )
+ *       if (...)
+ *           PFX_mut_remove(&it);    Removes and returns the current
+ *                                   element, moving on to the next
+ *       else
+ *           PFX_mut_next(&it);
+ *
+ * A PFX_iter is invalidated by anything that changes the list. While a
+ * PFX_mut_iter is in use the list may be changed only through it, and
+ * the removals take effect, each in O(1), when PFX_mut_done returns
+ * true; a loop left early must call PFX_mut_end instead.
+ *
+ * RING_DEFINE(Ring, PFX, Elem), in one .c file, defines the functions
+ * that are not inline. Push, pop, append and indexing are O(1).
+ */
+#define RING_DECLARE(Ring, PFX, Elem, SENTINEL)                                 \
+    typedef struct Ring##_ring *Ring;                                           \
+                                                                                \
+    /* Private: only the functions below use the fields */                     \
+    struct Ring##_ring                                                          \
+    {                                                                           \
+        Elem *elements;     /* ring buffer of capacity slots */                 \
+        int head;           /* slot holding element 0 */                        \
+        int length;         /* number of elements on the list */                \
+        int capacity;       /* number of slots; 0 or a power of two */          \
+        Arena arena;        /* storage comes from here, or NULL for malloc */   \
+    };                                                                          \
+                                                                                \
+    typedef void (*PFX##_foreach_callback)(int pos, Elem element, void *cb_data); \
+                                                                                \
+    Ring PFX##_new(void);                                                       \
+    Ring PFX##_new_in(Arena arena);                                             \
+    void PFX##_free(Ring list);                                                 \
+    void _##PFX##_reserve(Ring list, int min_capacity);                         \
+    bool PFX##_insert(Ring list, Elem element, int pos);                        \
+    Elem PFX##_remove(Ring list, int pos);                                      \
+    Ring PFX##_copy(Ring src_list);                                             \
+    void PFX##_join(Ring list1, Ring list2);                                    \
+    void PFX##_reverse(Ring list);                                              \
+    void PFX##_foreach(Ring list, PFX##_foreach_callback callback, void *cb_data); \
+                                                                                \
+    static inline Elem PFX##_sentinel(void)                                     \
+    {                                                                           \
+        return SENTINEL;                                                        \
+    }                                                                           \
+                                                                                \
+    /* Maps a position in [0, capacity) onto a slot of the buffer */            \
+    static inline int _##PFX##_slot(Ring list, int pos)                         \
+    {                                                                           \
+        return (list->head + pos) & (list->capacity - 1);                       \
+    }                                                                           \
+                                                                                \
+    static inline int PFX##_length(Ring list)                                   \
+    {                                                                           \
+        assert(list);                                                           \
+        ST_count(ST_LIST_OPS);                                                  \
+        assert(list->length >= 0 && list->length <= list->capacity);            \
+        assert((list->capacity & (list->capacity - 1)) == 0);                   \
+        return list->length;                                                    \
+    }                                                                           \
+                                                                                \
+    static inline Elem *PFX##_at(Ring list, int pos)                            \
+    {                                                                           \
+        assert(list);                                                           \
+        ST_count(ST_LIST_OPS);                                                  \
+        if (pos < -list->length || pos >= list->length)                         \
+            return NULL;                                                        \
+        if (pos < 0)                                                            \
+            pos += list->length;                                                \
+        return &list->elements[_##PFX##_slot(list, pos)];                       \
+    }                                                                           \
+                                                                                \
+    static inline Elem PFX##_nth(Ring list, int pos)                            \
+    {                                                                           \
+        Elem *element = PFX##_at(list, pos);                                    \
+        return element ? *element : PFX##_sentinel();                           \
+    }                                                                           \
+                                                                                \
+    static inline void PFX##_append(Ring list, Elem element)                    \
+    {                                                                           \
+        assert(list);                                                           \
+        ST_count(ST_LIST_OPS);                                                  \
+        if (__builtin_expect(list->length == list->capacity, 0))                \
+            _##PFX##_reserve(list, list->length + 1);                           \
+        list->elements[_##PFX##_slot(list, list->length)] = element;            \
+        list->length++;                                                         \
+    }                                                                           \
+                                                                                \
+    static inline void PFX##_push(Ring list, Elem element)                      \
+    {                                                                           \
+        assert(list);                                                           \
+        ST_count(ST_LIST_OPS);                                                  \
+        if (__builtin_expect(list->length == list->capacity, 0))                \
+            _##PFX##_reserve(list, list->length + 1);                           \
+        list->head = (list->head - 1) & (list->capacity - 1);                   \
+        list->elements[list->head] = element;                                   \
+        list->length++;                                                         \
+    }                                                                           \
+                                                                                \
+    static inline Elem PFX##_pop(Ring list)                                     \
+    {                                                                           \
+        assert(list);                                                           \
+        ST_count(ST_LIST_OPS);                                                  \
+        if (list->length == 0)                                                  \
+            return PFX##_sentinel();                                            \
+        Elem element = list->elements[list->head];                              \
+        list->head = (list->head + 1) & (list->capacity - 1);                   \
+        list->length--;                                                         \
+        return element;                                                         \
+    }                                                                           \
+                                                                                \
+    typedef struct                                                              \
+    {                                                                           \
+        Ring list;                                                              \
+        int pos;                                                                \
+    } PFX##_iter;                                                               \
+                                                                                \
+    static inline PFX##_iter PFX##_begin(Ring list)                             \
+    {                                                                           \
+        assert(list);                                                           \
+        return (PFX##_iter){list, 0};                                           \
+    }                                                                           \
+                                                                                \
+    static inline bool PFX##_done(const PFX##_iter *it)                         \
+    {                                                                           \
+        return it->pos >= it->list->length;                                     \
+    }                                                                           \
+                                                                                \
+    static inline Elem *PFX##_current(const PFX##_iter *it)                     \
+    {                                                                           \
+        assert(it->pos < it->list->length);                                     \
+        return &it->list->elements[_##PFX##_slot(it->list, it->pos)];           \
+    }                                                                           \
+                                                                                \
+    static inline void PFX##_next(PFX##_iter *it)                               \
+    {                                                                           \
+        it->pos++;                                                              \
+    }                                                                           \
+                                                                                \
+    /* Elements before keep are kept, those from pos on not yet visited, */     \
+    /* and those in between removed, leaving a gap that moves up the list */    \
+    typedef struct                                                              \
+    {                                                                           \
+        Ring list;                                                              \
+        int pos;                                                                \
+        int keep;                                                               \
+    } PFX##_mut_iter;                                                           \
+                                                                                \
+    static inline PFX##_mut_iter PFX##_mut_begin(Ring list)                     \
+    {                                                                           \
+        assert(list);                                                           \
+        return (PFX##_mut_iter){list, 0, 0};                                    \
+    }                                                                           \
+                                                                                \
+    /* Closes the gap, shifting down whatever was not visited */                \
+    static inline void PFX##_mut_end(PFX##_mut_iter *it)                        \
+    {                                                                           \
+        Ring list = it->list;                                                   \
+        if (it->keep < it->pos)                                                 \
+        {                                                                       \
+            for (int i = it->pos; i < list->length; i++)                        \
+                list->elements[_##PFX##_slot(list, it->keep + i - it->pos)] =   \
+                    list->elements[_##PFX##_slot(list, i)];                     \
+            list->length -= it->pos - it->keep;                                 \
+        }                                                                       \
+        it->pos = it->keep = list->length;                                      \
+    }                                                                           \
+                                                                                \
+    static inline bool PFX##_mut_done(PFX##_mut_iter *it)                       \
+    {                                                                           \
+        if (it->pos < it->list->length)                                         \
+            return false;                                                       \
+        PFX##_mut_end(it);                                                      \
+        return true;                                                            \
+    }                                                                           \
+                                                                                \
+    static inline Elem *PFX##_mut_current(const PFX##_mut_iter *it)             \
+    {                                                                           \
+        assert(it->pos < it->list->length);                                     \
+        return &it->list->elements[_##PFX##_slot(it->list, it->pos)];           \
+    }                                                                           \
+                                                                                \
+    static inline void PFX##_mut_next(PFX##_mut_iter *it)                       \
+    {                                                                           \
+        Ring list = it->list;                                                   \
+        assert(it->pos < list->length);                                         \
+        if (it->keep < it->pos)                                                 \
+            list->elements[_##PFX##_slot(list, it->keep)] =                     \
+                list->elements[_##PFX##_slot(list, it->pos)];                   \
+        it->keep++;                                                             \
+        it->pos++;                                                              \
+    }                                                                           \
+                                                                                \
+    static inline Elem PFX##_mut_remove(PFX##_mut_iter *it)                     \
+    {                                                                           \
+        Elem element = *PFX##_mut_current(it);                                  \
+        it->pos++;                                                              \
+        return element;                                                         \
+    }
+
+
+// Capacity of a ring list on its first insertion; a power of two
+#define RING_INITIAL_CAPACITY 16
+
+#define RING_DEFINE(Ring, PFX, Elem)                                            \
+    /* Grows the buffer to hold min_capacity elements, unwrapping them */       \
+    void _##PFX##_reserve(Ring list, int min_capacity)                          \
+    {                                                                           \
+        if (min_capacity <= list->capacity)                                     \
+            return;                                                             \
+                                                                                \
+        int new_capacity = list->capacity ? list->capacity : RING_INITIAL_CAPACITY; \
+        while (new_capacity < min_capacity)                                     \
+            new_capacity *= 2;                                                  \
+                                                                                \
+        Elem *elements;                                                         \
+        if (list->arena)                                                        \
+            elements = AR_alloc(list->arena, new_capacity * sizeof(Elem));      \
+        else                                                                    \
+        {                                                                       \
+            elements = malloc(new_capacity * sizeof(Elem));                     \
+            ST_count(ST_HEAP_ALLOCS);                                           \
+        }                                                                       \
+        assert(elements);                                                       \
+                                                                                \
+        if (list->length > 0)                                                   \
+        {                                                                       \
+            /* copy the (possibly wrapped) contents in two runs */              \
+            int first = list->capacity - list->head;                            \
+            if (first > list->length)                                           \
+                first = list->length;                                           \
+            memcpy(elements, &list->elements[list->head], first * sizeof(Elem)); \
+            memcpy(&elements[first], list->elements,                            \
+                   (list->length - first) * sizeof(Elem));                      \
+        }                                                                       \
+                                                                                \
+        if (!list->arena)                                                       \
+            free(list->elements);                                               \
+        list->elements = elements;                                              \
+        list->head = 0;                                                         \
+        list->capacity = new_capacity;                                          \
+    }                                                                           \
+                                                                                \
+    Ring PFX##_new(void)                                                        \
+    {                                                                           \
+        return PFX##_new_in(NULL);                                              \
+    }                                                                           \
+                                                                                \
+    Ring PFX##_new_in(Arena arena)                                              \
+    {                                                                           \
+        Ring list;                                                              \
+        if (arena)                                                              \
+            list = AR_alloc(arena, sizeof(struct Ring##_ring));                 \
+        else                                                                    \
+        {                                                                       \
+            list = malloc(sizeof(struct Ring##_ring));                          \
+            ST_count(ST_HEAP_ALLOCS);                                           \
+        }                                                                       \
+        assert(list);                                                           \
+                                                                                \
+        *list = (struct Ring##_ring){.arena = arena};                           \
+        return list;                                                            \
+    }                                                                           \
+                                                                                \
+    void PFX##_free(Ring list)                                                  \
+    {                                                                           \
+        /* An arena-backed list goes away when its arena is reset */            \
+        if (list == NULL || list->arena)                                        \
+            return;                                                             \
+                                                                                \
+        free(list->elements);                                                   \
+        free(list);                                                             \
+    }                                                                           \
+                                                                                \
+    bool PFX##_insert(Ring list, Elem element, int pos)                         \
+    {                                                                           \
+        assert(list);                                                           \
+        ST_count(ST_LIST_OPS);                                                  \
+                                                                                \
+        if (pos < -list->length - 1 || pos > list->length)                      \
+            return false;                                                       \
+        if (pos < 0)                                                            \
+            pos = list->length + pos + 1;                                       \
+                                                                                \
+        _##PFX##_reserve(list, list->length + 1);                               \
+                                                                                \
+        if (pos < list->length / 2)                                             \
+        {                                                                       \
+            /* Closer to the head: open a slot before the head and shift */     \
+            /* the first pos elements down by one */                            \
+            list->head = (list->head - 1) & (list->capacity - 1);               \
+            for (int i = 0; i < pos; i++)                                       \
+                list->elements[_##PFX##_slot(list, i)] =                        \
+                    list->elements[_##PFX##_slot(list, i + 1)];                 \
+        }                                                                       \
+        else                                                                    \
+        {                                                                       \
+            /* Closer to the tail: shift the elements from pos up by one */     \
+            for (int i = list->length; i > pos; i--)                            \
+                list->elements[_##PFX##_slot(list, i)] =                        \
+                    list->elements[_##PFX##_slot(list, i - 1)];                 \
+        }                                                                       \
+                                                                                \
+        list->elements[_##PFX##_slot(list, pos)] = element;                     \
+        list->length++;                                                         \
+        return true;                                                            \
+    }                                                                           \
+                                                                                \
+    Elem PFX##_remove(Ring list, int pos)                                       \
+    {                                                                           \
+        assert(list);                                                           \
+        ST_count(ST_LIST_OPS);                                                  \
+                                                                                \
+        if (pos < -list->length || pos >= list->length)                         \
+            return PFX##_sentinel();                                            \
+        if (pos < 0)                                                            \
+            pos = list->length + pos;                                           \
+                                                                                \
+        Elem removed = list->elements[_##PFX##_slot(list, pos)];                \
+                                                                                \
+        if (pos < list->length / 2)                                             \
+        {                                                                       \
+            /* Closer to the head: shift the preceding elements up by one */    \
+            for (int i = pos; i > 0; i--)                                       \
+                list->elements[_##PFX##_slot(list, i)] =                        \
+                    list->elements[_##PFX##_slot(list, i - 1)];                 \
+            list->head = (list->head + 1) & (list->capacity - 1);               \
+        }                                                                       \
+        else                                                                    \
+        {                                                                       \
+            /* Closer to the tail: shift the following elements down */        \
+            for (int i = pos; i < list->length - 1; i++)                        \
+                list->elements[_##PFX##_slot(list, i)] =                        \
+                    list->elements[_##PFX##_slot(list, i + 1)];                 \
+        }                                                                       \
+                                                                                \
+        list->length--;                                                         \
+        return removed;                                                         \
+    }                                                                           \
+                                                                                \
+    Ring PFX##_copy(Ring src_list)                                              \
+    {                                                                           \
+        assert(src_list);                                                       \
+        ST_count(ST_LIST_OPS);                                                  \
+                                                                                \
+        Ring new_list = PFX##_new_in(src_list->arena);                          \
+        _##PFX##_reserve(new_list, src_list->length);                           \
+                                                                                \
+        for (int i = 0; i < src_list->length; i++)                              \
+            new_list->elements[i] = src_list->elements[_##PFX##_slot(src_list, i)]; \
+        new_list->length = src_list->length;                                    \
+                                                                                \
+        return new_list;                                                        \
+    }                                                                           \
+                                                                                \
+    void PFX##_join(Ring list1, Ring list2)                                     \
+    {                                                                           \
+        assert(list1 && list2);                                                 \
+        ST_count(ST_LIST_OPS);                                                  \
+                                                                                \
+        if (list2->length == 0)                                                 \
+            return;                                                             \
+                                                                                \
+        _##PFX##_reserve(list1, list1->length + list2->length);                 \
+        for (int i = 0; i < list2->length; i++)                                 \
+            list1->elements[_##PFX##_slot(list1, list1->length + i)] =          \
+                list2->elements[_##PFX##_slot(list2, i)];                       \
+                                                                                \
+        list1->length += list2->length;                                         \
+        list2->head = 0;                                                        \
+        list2->length = 0;                                                      \
+    }                                                                           \
+                                                                                \
+    void PFX##_reverse(Ring list)                                               \
+    {                                                                           \
+        assert(list);                                                           \
+        ST_count(ST_LIST_OPS);                                                  \
+                                                                                \
+        for (int i = 0, j = list->length - 1; i < j; i++, j--)                  \
+        {                                                                       \
+            int a = _##PFX##_slot(list, i), b = _##PFX##_slot(list, j);         \
+            Elem tmp = list->elements[a];                                       \
+            list->elements[a] = list->elements[b];                              \
+            list->elements[b] = tmp;                                            \
+        }                                                                       \
+    }                                                                           \
+                                                                                \
+    void PFX##_foreach(Ring list, PFX##_foreach_callback callback, void *cb_data) \
+    {                                                                           \
+        assert(list && callback);                                               \
+        ST_count(ST_LIST_OPS);                                                  \
+                                                                                \
+        for (int pos = 0; pos < list->length; pos++)                            \
+            callback(pos, list->elements[_##PFX##_slot(list, pos)], cb_data);   \
+    }
+
+
+/*
+ * Vectors. VEC_DECLARE(Vec, PFX, Elem) declares the struct type Vec,
+ * which is used by value (embedded in another struct, say), and these
+ * inline functions:
+ *
+ *   void  PFX_init(Vec *vec, Arena arena)  Makes vec empty, to allocate
+ *                                          from arena, or malloc if NULL
+ *   void  PFX_free(Vec *vec)               Frees a malloc'd vec's storage
+ *   int   PFX_length(const Vec *vec)
+ *   Elem *PFX_at(Vec *vec, int i)          The element at i, in place;
+ *                                          i must be in range
+ *   Elem *PFX_append(Vec *vec)             A new element at the end, to
+ *                                          be filled in in place
+ *
+ * A zero-filled Vec is empty, and allocates with malloc.
+ */
+#define VEC_DECLARE(Vec, PFX, Elem)                                             \
+    typedef struct                                                              \
+    {                                                                           \
+        Elem *items;                                                            \
+        int length;                                                             \
+        int capacity;                                                           \
+        Arena arena;                                                            \
+    } Vec;                                                                      \
+                                                                                \
+    static inline void PFX##_init(Vec *vec, Arena arena)                        \
+    {                                                                           \
+        *vec = (Vec){.arena = arena};                                           \
+    }                                                                           \
+                                                                                \
+    static inline void PFX##_free(Vec *vec)                                     \
+    {                                                                           \
+        /* An arena's storage goes away when the arena is reset */              \
+        if (!vec->arena)                                                        \
+            free(vec->items);                                                   \
+        vec->items = NULL;                                                      \
+        vec->length = vec->capacity = 0;                                        \
+    }                                                                           \
+                                                                                \
+    static inline int PFX##_length(const Vec *vec)                              \
+    {                                                                           \
+        return vec->length;                                                     \
+    }                                                                           \
+                                                                                \
+    static inline Elem *PFX##_at(Vec *vec, int i)                               \
+    {                                                                           \
+        assert(i >= 0 && i < vec->length);                                      \
+        return &vec->items[i];                                                  \
+    }                                                                           \
+                                                                                \
+    /* Doubles the capacity; kept out of line, as it is rarely called */       \
+    __attribute__((noinline, cold, unused))                                     \
+    static void _##PFX##_grow(Vec *vec)                                         \
+    {                                                                           \
+        int capacity = vec->capacity ? vec->capacity * 2 : 4;                   \
+        if (vec->arena)                                                         \
+            vec->items = AR_realloc(vec->arena, vec->items,                     \
+                                    vec->capacity * sizeof(Elem),               \
+                                    capacity * sizeof(Elem));                   \
+        else                                                                    \
+        {                                                                       \
+            vec->items = realloc(vec->items, capacity * sizeof(Elem));          \
+            ST_count(ST_HEAP_ALLOCS);                                           \
+        }                                                                       \
+        assert(vec->items);                                                     \
+        vec->capacity = capacity;                                               \
+    }                                                                           \
+                                                                                \
+    static inline Elem *PFX##_append(Vec *vec)                                  \
+    {                                                                           \
+        if (__builtin_expect(vec->length == vec->capacity, 0))                  \
+            _##PFX##_grow(vec);                                                 \
+        return &vec->items[vec->length++];                                      \
+    }
+
+
+/*
+ * Intrusive lists. The objects on the list hold the links themselves,
+ * in an IListLink member, so adding one allocates nothing, and an
+ * object can be removed in O(1) given just a pointer to it. The list
+ * is circular through a sentinel link in the list itself, so there
+ * are no special cases at either end.
+ *
+ * ILIST_DECLARE(List, PFX, Type, field) declares the list type List,
+ * of Types linked through their IListLink member field, and these
+ * inline functions:
+ *
+ *   void  PFX_init(List *list)
+ *   bool  PFX_empty(const List *list)
+ *   void  PFX_push_front(List *list, Type *obj)
+ *   void  PFX_push_back(List *list, Type *obj)
+ *   void  PFX_remove(Type *obj)       Removes obj from whatever list it is on
+ *   Type *PFX_first(List *list)       The first object, or NULL
+ *   Type *PFX_next(List *list, Type *obj)  The object after obj, or NULL
+ *
+ * A static List can be initialized with ILIST_INIT(name).
+ */
+typedef struct ilist_link
+{
+    struct ilist_link *prev;
+    struct ilist_link *next;
+} IListLink;
+
+#define ILIST_INIT(name) { { &(name).sentinel, &(name).sentinel } }
+
+#define ILIST_DECLARE(List, PFX, Type, field)                                   \
+    typedef struct                                                              \
+    {                                                                           \
+        IListLink sentinel;   /* next is the first, prev the last */            \
+    } List;                                                                     \
+                                                                                \
+    static inline void PFX##_init(List *list)                                   \
+    {                                                                           \
+        list->sentinel.prev = list->sentinel.next = &list->sentinel;            \
+    }                                                                           \
+                                                                                \
+    static inline bool PFX##_empty(const List *list)                            \
+    {                                                                           \
+        return list->sentinel.next == &list->sentinel;                          \
+    }                                                                           \
+                                                                                \
+    /* The object holding a link, or NULL for the sentinel */                   \
+    static inline Type *_##PFX##_object(List *list, IListLink *link)            \
+    {                                                                           \
+        if (link == &list->sentinel)                                            \
+            return NULL;                                                        \
+        return (Type *) ((char *) link - offsetof(Type, field));                \
+    }                                                                           \
+                                                                                \
+    static inline void _##PFX##_link(IListLink *link, IListLink *prev, IListLink *next) \
+    {                                                                           \
+        link->prev = prev;                                                      \
+        link->next = next;                                                      \
+        prev->next = link;                                                      \
+        next->prev = link;                                                      \
+    }                                                                           \
+                                                                                \
+    static inline void PFX##_push_front(List *list, Type *obj)                  \
+    {                                                                           \
+        _##PFX##_link(&obj->field, &list->sentinel, list->sentinel.next);       \
+    }                                                                           \
+                                                                                \
+    static inline void PFX##_push_back(List *list, Type *obj)                   \
+    {                                                                           \
+        _##PFX##_link(&obj->field, list->sentinel.prev, &list->sentinel);       \
+    }                                                                           \
+                                                                                \
+    static inline void PFX##_remove(Type *obj)                                  \
+    {                                                                           \
+        obj->field.prev->next = obj->field.next;                                \
+        obj->field.next->prev = obj->field.prev;                                \
+        obj->field.prev = obj->field.next = NULL;                               \
+    }                                                                           \
+                                                                                \
+    static inline Type *PFX##_first(List *list)                                 \
+    {                                                                           \
+        return _##PFX##_object(list, list->sentinel.next);                      \
+    }                                                                           \
+                                                                                \
+    static inline Type *PFX##_next(List *list, Type *obj)                       \
+    {                                                                           \
+        return _##PFX##_object(list, obj->field.next);                          \
+    }
+
+#endif /* _CONTAINER_H_ */
@@ -0,0 +1,298 @@
+/*
+ * env.c
+ *
+ * The shell's environment variables. Each variable is a single
+ * "name=value" string, found through a hash table by its name. The
+ * same strings, in an array, are the environment given to launched
+ * commands: setting a variable replaces one element of the array and
+ * removing one moves the last into its place, so the array is never
+ * rebuilt, and launching a command costs nothing for the environment
+ * however many variables there are.
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "env.h"
+
+#define EN_NBUCKETS 256
+
+extern char **environ;
+
+// One variable
+struct en_var
+{
+    char *entry;              // "name=value"
+    size_t name_len;
+    int index;                // Where entry is in envp
+    struct en_var *next;
+};
+
+static struct
+{
+    struct en_var *buckets[EN_NBUCKETS];
+    char **envp;              // Every entry, followed by NULL
+    int count;
+    int cap;
+    pthread_rwlock_t lock;    // Held for writing while anything changes
+} env = {.lock = PTHREAD_RWLOCK_INITIALIZER};
+
+static pthread_once_t env_once = PTHREAD_ONCE_INIT;
+
+
+/*
+ * FNV-1a hash of a variable name
+ *
+ * Parameters:
+ *   name     The name
+ *   len      The length of name
+ *
+ * Returns: The bucket for name
+ */
+static unsigned hash_name(const char *name, size_t len)
+{
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char) name[i]) * 16777619u;
+
+    return h % EN_NBUCKETS;
+}
+
+
+/*
+ * Finds a variable
+ *
+ * Parameters:
+ *   name     The name
+ *   len      The length of name
+ *
+ * Returns: The variable, or NULL if it is not set
+ */
+static struct en_var *find_var(const char *name, size_t len)
+{
+    for (struct en_var *v = env.buckets[hash_name(name, len)]; v != NULL; v = v->next)
+        if (v->name_len == len && memcmp(v->entry, name, len) == 0)
+            return v;
+
+    return NULL;
+}
+
+
+/*
+ * Sets a variable from a "name=value" string
+ *
+ * Parameters:
+ *   entry    The string, malloc'd, which the variable takes over
+ *   name_len The length of the name
+ *
+ * Returns: None
+ */
+static void set_entry(char *entry, size_t name_len)
+{
+    struct en_var *v = find_var(entry, name_len);
+
+    if (v != NULL)
+    {
+        free(v->entry);
+        v->entry = entry;
+        env.envp[v->index] = entry;
+        return;
+    }
+
+    if (env.count + 1 >= env.cap)
+    {
+        env.cap = env.cap ? env.cap * 2 : 64;
+        env.envp = realloc(env.envp, env.cap * sizeof(char *));
+        assert(env.envp);
+    }
+
+    v = malloc(sizeof(struct en_var));
+    assert(v);
+    unsigned b = hash_name(entry, name_len);
+    *v = (struct en_var){.entry = entry, .name_len = name_len, .index = env.count,
+                         .next = env.buckets[b]};
+    env.buckets[b] = v;
+
+    env.envp[env.count++] = entry;
+    env.envp[env.count] = NULL;
+}
+
+
+// pthread_once routine: loads the environment the shell was started with
+static void load_environ(void)
+{
+    env.cap = 64;
+    env.envp = malloc(env.cap * sizeof(char *));
+    assert(env.envp);
+    env.envp[0] = NULL;
+
+    for (char **e = environ; e != NULL && *e != NULL; e++)
+    {
+        const char *eq = strchr(*e, '=');
+
+        // As with getenv, the first of any duplicates wins
+        if (eq == NULL || find_var(*e, eq - *e) != NULL)
+            continue;
+
+        char *entry = strdup(*e);
+        assert(entry);
+        set_entry(entry, eq - *e);
+    }
+}
+
+
+// Documented in .h file
+bool EN_valid_name(const char *name, size_t len)
+{
+    if (len == 0 || (name[0] >= '0' && name[0] <= '9'))
+        return false;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_'))
+            return false;
+    }
+
+    return true;
+}
+
+
+// Documented in .h file
+void EN_read_lock(void)
+{
+    pthread_rwlock_rdlock(&env.lock);
+}
+
+
+// Documented in .h file
+void EN_read_unlock(void)
+{
+    pthread_rwlock_unlock(&env.lock);
+}
+
+
+// Documented in .h file
+const char *EN_get(const char *name)
+{
+    pthread_once(&env_once, load_environ);
+
+    size_t len = strlen(name);
+    struct en_var *v = find_var(name, len);
+
+    return v ? &v->entry[len + 1] : NULL;
+}
+
+
+// Documented in .h file
+void EN_set(const char *name, const char *value)
+{
+    pthread_once(&env_once, load_environ);
+
+    size_t name_len = strlen(name), value_len = strlen(value);
+    assert(EN_valid_name(name, name_len));
+
+    char *entry = malloc(name_len + value_len + 2);
+    assert(entry);
+    memcpy(entry, name, name_len);
+    entry[name_len] = '=';
+    memcpy(&entry[name_len + 1], value, value_len + 1);
+
+    // Other threads may be reading the old entry, or envp
+    pthread_rwlock_wrlock(&env.lock);
+    set_entry(entry, name_len);
+    pthread_rwlock_unlock(&env.lock);
+}
+
+
+// Documented in .h file
+void EN_unset(const char *name)
+{
+    pthread_once(&env_once, load_environ);
+
+    size_t len = strlen(name);
+    pthread_rwlock_wrlock(&env.lock);
+    struct en_var **link = &env.buckets[hash_name(name, len)];
+
+    while (*link != NULL && ((*link)->name_len != len || memcmp((*link)->entry, name, len) != 0))
+        link = &(*link)->next;
+
+    struct en_var *v = *link;
+    if (v == NULL)
+    {
+        pthread_rwlock_unlock(&env.lock);
+        return;
+    }
+    *link = v->next;
+
+    // The last entry fills the hole
+    env.count--;
+    if (v->index != env.count)
+    {
+        char *last = env.envp[env.count];
+        env.envp[v->index] = last;
+        find_var(last, strchr(last, '=') - last)->index = v->index;
+    }
+    env.envp[env.count] = NULL;
+
+    pthread_rwlock_unlock(&env.lock);
+    free(v->entry);
+    free(v);
+}
+
+
+// Documented in .h file
+char **EN_envp(void)
+{
+    pthread_once(&env_once, load_environ);
+
+    return env.envp;
+}
+
+
+// Documented in .h file
+void EN_print(FILE *out)
+{
+    pthread_once(&env_once, load_environ);
+
+    for (int i = 0; i < env.count; i++)
+    {
+        const char *entry = env.envp[i];
+        const char *value = strchr(entry, '=') + 1;
+
+        // Quoted so that it reads back as the same value
+        fprintf(out, "export %.*s=\"", (int) (value - entry - 1), entry);
+        for (const char *p = value; *p; p++)
+        {
+            switch (*p)
+            {
+            case '\n':
+                fputs("\\n", out);
+                break;
+            case '\r':
+                fputs("\\r", out);
+                break;
+            case '\t':
+                fputs("\\t", out);
+                break;
+            case '"':
+            case '\\':
+            case '$':
+                fputc('\\', out);
+                fputc(*p, out);
+                break;
+            default:
+                fputc(*p, out);
+                break;
+            }
+        }
+        fputs("\"\n", out);
+    }
+}
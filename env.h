@@ -0,0 +1,116 @@
+/*
+ * env.h
+ *
+ * The shell's environment variables, kept in a hash table, with the
+ * environment array for launched commands kept up to date as they
+ * change. Variables are changed only by the main thread, which may
+ * read them freely. Any other thread must hold the read lock, from
+ * EN_read_lock, while it calls EN_get or EN_envp and for as long as it
+ * uses the result; changes wait until no thread holds it.
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#ifndef _ENV_H_
+#define _ENV_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+
+/*
+ * Check whether a string is a valid variable name: a letter or
+ * underscore, followed by letters, digits and underscores
+ *
+ * Parameters:
+ *   name     The name
+ *   len      The length of name
+ *
+ * Returns: true if name is valid
+ */
+bool EN_valid_name(const char *name, size_t len);
+
+
+/*
+ * Take the read lock, which keeps the variables from changing. Readers
+ * do not exclude one another.
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+void EN_read_lock(void);
+
+
+/*
+ * Release the read lock
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+void EN_read_unlock(void);
+
+
+/*
+ * Get the value of a variable. The environment the shell was started
+ * with is read the first time any variable is needed.
+ *
+ * Parameters:
+ *   name     The name of the variable
+ *
+ * Returns: The value, which is valid until the variable is next
+ *   changed (or, off the main thread, until the read lock is
+ *   released), or NULL if the variable is not set
+ */
+const char *EN_get(const char *name);
+
+
+/*
+ * Set a variable, replacing any previous value. Main thread only.
+ *
+ * Parameters:
+ *   name     The name of the variable, which must be valid
+ *   value    The new value
+ *
+ * Returns: None
+ */
+void EN_set(const char *name, const char *value);
+
+
+/*
+ * Remove a variable. Does nothing if it is not set. Main thread only.
+ *
+ * Parameters:
+ *   name     The name of the variable
+ *
+ * Returns: None
+ */
+void EN_unset(const char *name);
+
+
+/*
+ * Get the environment to give a launched command. The array is not
+ * built for each call; it changes only when a variable does.
+ *
+ * Parameters: None
+ *
+ * Returns: The variables, as "name=value" strings followed by NULL,
+ *   valid until a variable is next changed (or, off the main thread,
+ *   until the read lock is released)
+ */
+char **EN_envp(void);
+
+
+/*
+ * Print every variable, as the export command that would set it
+ *
+ * Parameters:
+ *   out      The stream to print to
+ *
+ * Returns: None
+ */
+void EN_print(FILE *out);
+
+#endif /* _ENV_H_ */
@@ -0,0 +1,1000 @@
+/*
+ * executor.c
+ *
+ * Run pipelines of commands.
+ *
+ * Commands are launched with posix_spawn rather than fork+exec. glibc
+ * implements it with clone(CLONE_VM|CLONE_VFORK), so the child never
+ * copies the parent's page tables, which matters because the parent is
+ * an ASan build with a very large address space. All of the plumbing
+ * is expressed as spawn file actions.
+ *
+ * Builtins run inside the shell even when they are pipeline stages,
+ * writing straight to the stage's pipe. The last builtin stage of a
+ * foreground pipeline runs inline once every other stage has been
+ * started; any others run on threads of their own, so no builtin
+ * waits on a reader that has not started.
+ *
+ * Every running pipeline is a job. Nothing ever blocks in waitpid:
+ * each child has a pidfd, and each builtin thread signals an eventfd
+ * when it returns, all registered with one epoll instance. A
+ * foreground job is finished as soon as its last stage is, and
+ * background jobs are reaped whenever the shell looks at the epoll
+ * descriptor, which the interactive loop polls alongside its input.
+ *
+ * EX_run_sync is the exception: it runs a pipeline on the calling
+ * thread and waits for its children directly, for builtins such as
+ * parallel that launch commands from threads of their own.
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#define _GNU_SOURCE   // for pipe2 and F_SETPIPE_SZ
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "executor.h"
+#include "builtins.h"
+#include "container.h"
+#include "env.h"
+#include "pathcache.h"
+#include "stats.h"
+
+// Exit status used when a command could not be started
+#define EX_NOT_STARTED 127
+
+// Capacity requested for each pipe between stages. A bigger pipe means
+// fewer context switches when a pipeline moves a lot of data; if the
+// system refuses (see /proc/sys/fs/pipe-max-size), the default is kept.
+#define EX_PIPE_SIZE (1024 * 1024)
+
+// How often children without a pidfd are polled, in milliseconds
+#define EX_POLL_MS 10
+
+// Events handled per epoll_wait
+#define EX_MAX_EVENTS 16
+
+struct job;
+
+// One stage of a running pipeline
+typedef struct
+{
+    struct job *job;
+    const Command *cmd;       // Only valid while the job's pipeline is
+    const Builtin *builtin;   // The builtin running the stage, or NULL
+    pid_t pid;                // The child running the stage, or -1
+    int pidfd;                // Readable when the child exits, or -1
+    int in_fd;                // A builtin's standard input, or -1 for the shell's
+    int out_fd;               // A builtin's standard output, or -1 for the shell's
+    bool threaded;            // Whether the builtin runs on its own thread
+    bool finished;            // Set by a builtin thread as it returns
+    pthread_t thread;
+    bool running;             // Not yet reaped or joined
+    int status;
+} Stage;
+
+// A pipeline that has been started
+typedef struct job
+{
+    int id;                   // Job number, or 0 for a foreground job
+    bool detached;            // A foreground job that EX_run has returned from
+    char *text;               // The command line, for background jobs
+    Pipeline pl;              // Owned by the job, for background jobs
+    Stage *stages;
+    int nstages;
+    int running;              // Stages not yet reaped or joined
+    bool done;                // The last stage has finished
+    int status;               // The job's exit status, once done
+    IListLink link;           // On ex.jobs
+} Job;
+
+ILIST_DECLARE(JobList, JL, Job, link)
+
+static struct
+{
+    JobList jobs;             // Every job with something still running,
+                              //   and finished background jobs, newest first
+    int epoll_fd;
+    int wake_fd;              // eventfd written by builtin threads
+    int npolled;              // Children with no pidfd, polled instead
+    bool interactive;
+} ex = {ILIST_INIT(ex.jobs), -1, -1, 0, false};
+
+
+/*
+ * Creates the epoll instance and eventfd, the first time they are needed
+ *
+ * Parameters: None
+ * 
+ * Returns: None
+ */
+static void init_events(void)
+{
+    if (ex.epoll_fd >= 0)
+        return;
+
+    ex.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    ex.wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    assert(ex.epoll_fd >= 0 && ex.wake_fd >= 0);
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+    epoll_ctl(ex.epoll_fd, EPOLL_CTL_ADD, ex.wake_fd, &ev);
+}
+
+
+/*
+ * Opens a redirection file in the shell, so that errors can be reported
+ * precisely. The descriptor is close-on-exec; it reaches the child
+ * only through a dup2 file action.
+ *
+ * Parameters:
+ *   file    The filename
+ *   flags   Flags for open
+ * 
+ * Returns: The file descriptor, or -1 after reporting an error
+ */
+static int open_redirection(const char *file, int flags)
+{
+    int fd = open(file, flags | O_CLOEXEC, 0666);
+
+    if (fd < 0)
+        fprintf(stderr, "plaidsh: %s: %s\n", file, strerror(errno));
+
+    return fd;
+}
+
+
+/*
+ * Launches one command with its standard input and output connected to
+ * the given descriptors
+ *
+ * Parameters:
+ *   cmd      The command
+ *   in_fd    Descriptor for standard input, or -1 to inherit the shell's
+ *   out_fd   Descriptor for standard output, or -1 to inherit the shell's
+ * 
+ * Returns: The pid of the child, or -1 after reporting an error
+ */
+static pid_t spawn_command(const Command *cmd, int in_fd, int out_fd)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+
+    // The shell ignores SIGPIPE, so that builtins writing to a closed
+    // pipe see EPIPE; children must get the default back
+    posix_spawnattr_t attr;
+    sigset_t sigdefault;
+    posix_spawnattr_init(&attr);
+    sigemptyset(&sigdefault);
+    sigaddset(&sigdefault, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &sigdefault);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+    if (in_fd >= 0)
+        posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    if (out_fd >= 0)
+        posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+
+    pid_t pid;
+    char path[4096];
+    int err = ENOENT;
+
+    if (PC_lookup(cmd->name, path, sizeof(path)))
+    {
+        EN_read_lock();
+        err = posix_spawn(&pid, path, &actions, &attr, cmd->argv, EN_envp());
+        EN_read_unlock();
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (err != 0)
+    {
+        if (err == ENOENT)
+            fprintf(stderr, "plaidsh: %s: Command not found\n", cmd->argv[0]);
+        else
+            fprintf(stderr, "plaidsh: %s: %s\n", cmd->argv[0], strerror(err));
+        return -1;
+    }
+
+    return pid;
+}
+
+
+/*
+ * Runs a builtin stage to completion, then closes its descriptors so
+ * that its neighbours in the pipeline see end-of-file
+ *
+ * Parameters:
+ *   stage    The stage
+ * 
+ * Returns: None; the exit status is stored in stage->status
+ */
+static void run_builtin(Stage *stage)
+{
+    FILE *out = stdout;
+
+    if (stage->out_fd >= 0 && (out = fdopen(stage->out_fd, "w")) == NULL)
+    {
+        fprintf(stderr, "plaidsh: %s: %s\n", stage->cmd->argv[0], strerror(errno));
+        close(stage->out_fd);
+        stage->status = 1;
+    }
+    else
+    {
+        stage->status = stage->builtin->fn(stage->cmd->argc, stage->cmd->argv,
+                                           stage->in_fd >= 0 ? stage->in_fd : STDIN_FILENO, out);
+        if (out == stdout)
+            fflush(stdout);
+        else
+            fclose(out);    // also closes out_fd
+    }
+
+    if (stage->in_fd >= 0)
+        close(stage->in_fd);
+}
+
+
+// pthread entry point for run_builtin; wakes the shell when done
+static void *builtin_thread(void *arg)
+{
+    Stage *stage = arg;
+    uint64_t one = 1;
+
+    run_builtin(stage);
+
+    __atomic_store_n(&stage->finished, true, __ATOMIC_RELEASE);
+    if (write(ex.wake_fd, &one, sizeof(one)) < 0)
+        perror("plaidsh: eventfd");
+
+    return NULL;
+}
+
+
+// pthread entry point for run_builtin, for EX_run_sync, which joins it
+static void *sync_builtin_thread(void *arg)
+{
+    run_builtin(arg);
+    return NULL;
+}
+
+
+/*
+ * Watches a newly started child, through a pidfd if the kernel has them
+ *
+ * Parameters:
+ *   stage    The stage the child is running
+ * 
+ * Returns: None
+ */
+static void watch_child(Stage *stage)
+{
+    stage->pidfd = syscall(SYS_pidfd_open, stage->pid, 0);
+
+    if (stage->pidfd >= 0)
+    {
+        fcntl(stage->pidfd, F_SETFD, FD_CLOEXEC);
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = stage};
+        epoll_ctl(ex.epoll_fd, EPOLL_CTL_ADD, stage->pidfd, &ev);
+    }
+    else
+        ex.npolled++;
+}
+
+
+/*
+ * Records that a stage has finished. The job is done when its last
+ * stage is, or, if it could not all be started, when nothing is left.
+ *
+ * Parameters:
+ *   stage    The stage
+ *   status   Its exit status
+ * 
+ * Returns: None
+ */
+static void stage_finished(Stage *stage, int status)
+{
+    Job *job = stage->job;
+
+    stage->running = false;
+    stage->status = status;
+    job->running--;
+
+    if (stage == &job->stages[job->nstages - 1])
+    {
+        job->done = true;
+        job->status = status;
+    }
+}
+
+
+/*
+ * Converts a wait status to an exit status
+ *
+ * Parameters:
+ *   wstatus  The status from waitpid
+ * 
+ * Returns: The exit status
+ */
+static int exit_status(int wstatus)
+{
+    if (WIFSIGNALED(wstatus))
+        return 128 + WTERMSIG(wstatus);
+
+    return WEXITSTATUS(wstatus);
+}
+
+
+/*
+ * Reaps a child if it has exited
+ *
+ * Parameters:
+ *   stage    The stage the child is running
+ * 
+ * Returns: None
+ */
+static void reap_child(Stage *stage)
+{
+    int wstatus;
+    pid_t pid = waitpid(stage->pid, &wstatus, WNOHANG);
+
+    if (pid == 0 || (pid < 0 && errno == EINTR))
+        return;
+
+    if (stage->pidfd >= 0)
+    {
+        epoll_ctl(ex.epoll_fd, EPOLL_CTL_DEL, stage->pidfd, NULL);
+        close(stage->pidfd);
+        stage->pidfd = -1;
+    }
+    else
+        ex.npolled--;
+
+    stage_finished(stage, pid < 0 ? EX_NOT_STARTED : exit_status(wstatus));
+}
+
+
+/*
+ * Handles whatever has finished: reaps children and joins builtin
+ * threads, then frees foreground jobs with nothing left running
+ *
+ * Parameters:
+ *   timeout  How long to wait for something to finish, in milliseconds,
+ *            or -1 to wait indefinitely
+ * 
+ * Returns: None
+ */
+static void handle_events(int timeout)
+{
+    struct epoll_event events[EX_MAX_EVENTS];
+
+    if (ex.npolled > 0 && (timeout < 0 || timeout > EX_POLL_MS))
+        timeout = EX_POLL_MS;
+
+    int n = epoll_wait(ex.epoll_fd, events, EX_MAX_EVENTS, timeout);
+
+    for (int i = 0; i < n; i++)
+    {
+        if (events[i].data.ptr == NULL)
+        {
+            // A builtin thread has returned; it is found below
+            uint64_t count;
+            if (read(ex.wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                perror("plaidsh: eventfd");
+        }
+        else
+            reap_child(events[i].data.ptr);
+    }
+
+    for (Job *job = JL_first(&ex.jobs); job != NULL; job = JL_next(&ex.jobs, job))
+    {
+        for (int i = 0; i < job->nstages; i++)
+        {
+            Stage *stage = &job->stages[i];
+
+            if (!stage->running)
+                continue;
+
+            if (stage->threaded &&
+                __atomic_load_n(&stage->finished, __ATOMIC_ACQUIRE))
+            {
+                pthread_join(stage->thread, NULL);
+                stage_finished(stage, stage->status);
+            }
+            else if (stage->pid > 0 && stage->pidfd < 0)
+                reap_child(stage);
+        }
+    }
+
+    // Foreground leftovers are forgotten once everything is reaped
+    for (Job *job = JL_first(&ex.jobs), *next; job != NULL; job = next)
+    {
+        next = JL_next(&ex.jobs, job);
+
+        if (job->detached && job->running == 0)
+        {
+            JL_remove(job);
+            free(job->stages);
+            free(job);
+        }
+    }
+}
+
+
+/*
+ * Builds the text of a background job's command line, for jobs
+ *
+ * Parameters:
+ *   pl       The pipeline
+ * 
+ * Returns: The malloc'd text
+ */
+static char *job_text(Pipeline pl)
+{
+    size_t len = 3;
+
+    for (int i = 0; i < PL_length(pl); i++)
+        for (int j = 0; j < PL_command(pl, i)->argc; j++)
+            len += strlen(PL_command(pl, i)->argv[j]) + 3;
+    if (PL_input_file(pl))
+        len += strlen(PL_input_file(pl)) + 3;
+    if (PL_output_file(pl))
+        len += strlen(PL_output_file(pl)) + 3;
+
+    char *text = malloc(len);
+    assert(text);
+    char *p = text;
+
+    for (int i = 0; i < PL_length(pl); i++)
+    {
+        const Command *cmd = PL_command(pl, i);
+
+        for (int j = 0; j < cmd->argc; j++)
+            p += sprintf(p, "%s%s", j ? " " : (i ? " | " : ""), cmd->argv[j]);
+        if (i == 0 && PL_input_file(pl))
+            p += sprintf(p, " < %s", PL_input_file(pl));
+    }
+    if (PL_output_file(pl))
+        p += sprintf(p, " > %s", PL_output_file(pl));
+    strcpy(p, " &");
+
+    return text;
+}
+
+
+/*
+ * Finds the background job with a given number
+ *
+ * Parameters:
+ *   id       The job number
+ * 
+ * Returns: The job, or NULL if there is none
+ */
+static Job *find_job(int id)
+{
+    for (Job *job = JL_first(&ex.jobs); job != NULL; job = JL_next(&ex.jobs, job))
+        if (job->id == id)
+            return job;
+
+    return NULL;
+}
+
+
+/*
+ * Removes a finished background job from the job list and frees it
+ *
+ * Parameters:
+ *   job      The job
+ * 
+ * Returns: None
+ */
+static void remove_job(Job *job)
+{
+    JL_remove(job);
+
+    free(job->text);
+    free(job->stages);
+    PL_free(job->pl);
+    free(job);
+}
+
+
+/*
+ * Prints the state of a background job
+ *
+ * Parameters:
+ *   out      Where to print
+ *   job      The job
+ * 
+ * Returns: None
+ */
+static void print_job(FILE *out, const Job *job)
+{
+    char state[32];
+
+    if (!job->done || job->running > 0)
+        snprintf(state, sizeof(state), "Running");
+    else if (job->status == 0)
+        snprintf(state, sizeof(state), "Done");
+    else
+        snprintf(state, sizeof(state), "Exit %d", job->status);
+
+    fprintf(out, "[%d]  %-10s %s\n", job->id, state, job->text);
+}
+
+
+// Whether a background job has finished completely
+static bool job_finished(const Job *job)
+{
+    return job->id > 0 && job->done && job->running == 0;
+}
+
+
+// Documented in .h file
+int EX_run(Pipeline pl)
+{
+    int n = PL_length(pl);
+    bool background = PL_background(pl);
+
+    if (n == 0)
+    {
+        if (background)
+            PL_free(pl);
+        return 0;
+    }
+
+    init_events();
+
+    uint64_t launch_start = ST_start();
+    int in_fd = -1, out_fd = -1;
+
+    if ((PL_input_file(pl) && (in_fd = open_redirection(PL_input_file(pl), O_RDONLY)) < 0) ||
+        (PL_output_file(pl) &&
+         (out_fd = open_redirection(PL_output_file(pl), O_WRONLY | O_CREAT | O_TRUNC)) < 0))
+    {
+        if (in_fd >= 0)
+            close(in_fd);
+        if (background)
+            PL_free(pl);
+        return 1;
+    }
+
+    Job *job = calloc(1, sizeof(Job));
+    job->stages = calloc(n, sizeof(Stage));
+    assert(job && job->stages);
+    job->nstages = n;
+
+    // The last builtin stage of a foreground job is run inline, after
+    // the loop; a background job's builtins all get threads
+    int inline_stage = -1;
+    for (int i = 0; i < n; i++)
+    {
+        Stage *stage = &job->stages[i];
+
+        stage->job = job;
+        stage->cmd = PL_command(pl, i);
+        stage->pid = stage->pidfd = -1;
+        stage->status = EX_NOT_STARTED;
+        stage->builtin = BI_for_command(stage->cmd);
+        if (stage->builtin != NULL && !background)
+            inline_stage = i;
+    }
+
+    // Each command reads from prev_fd, which is the previous command's
+    // pipe or the input redirection
+    int prev_fd = in_fd;
+    int started = 0;
+
+    for (int i = 0; i < n; i++, started++)
+    {
+        Stage *stage = &job->stages[i];
+        int pipefd[2] = {-1, -1};
+        int stage_out = out_fd;
+
+        if (i < n - 1)
+        {
+            if (pipe2(pipefd, O_CLOEXEC) < 0)
+            {
+                fprintf(stderr, "plaidsh: pipe: %s\n", strerror(errno));
+                break;
+            }
+            stage_out = pipefd[1];
+            fcntl(pipefd[1], F_SETPIPE_SZ, EX_PIPE_SIZE);
+        }
+
+        if (stage->builtin != NULL && n == 1 && !background)
+        {
+            // A lone builtin may change the shell itself; it runs inline
+            stage->in_fd = prev_fd;
+            stage->out_fd = (out_fd >= 0) ? fcntl(out_fd, F_DUPFD_CLOEXEC, 0) : -1;
+            stage->running = true;
+            job->running++;
+        }
+        else if (stage->builtin != NULL && !stage->builtin->shell_only)
+        {
+            // The stage takes over its descriptors
+            stage->in_fd = prev_fd;
+            stage->out_fd = (i == n - 1 && out_fd >= 0) ? fcntl(out_fd, F_DUPFD_CLOEXEC, 0) : stage_out;
+            stage->running = true;
+            job->running++;
+
+            if (i != inline_stage)
+            {
+                stage->threaded = true;
+                if (pthread_create(&stage->thread, NULL, builtin_thread, stage) != 0)
+                {
+                    fprintf(stderr, "plaidsh: %s: cannot start thread\n", stage->cmd->argv[0]);
+                    stage->running = false;
+                    job->running--;
+                    if (stage->in_fd >= 0)
+                        close(stage->in_fd);
+                    if (stage->out_fd >= 0)
+                        close(stage->out_fd);
+                }
+            }
+        }
+        else
+        {
+            if (stage->builtin != NULL)
+            {
+                fprintf(stderr, "plaidsh: %s: cannot be used in %s\n", stage->builtin->name,
+                        background ? "the background" : "a pipeline");
+                stage->builtin = NULL;
+                stage->status = 1;
+            }
+            else if ((stage->pid = spawn_command(stage->cmd, prev_fd, stage_out)) > 0)
+            {
+                stage->running = true;
+                job->running++;
+                watch_child(stage);
+            }
+
+            // The child has its own copies now
+            if (prev_fd >= 0)
+                close(prev_fd);
+            if (pipefd[1] >= 0)
+                close(pipefd[1]);
+        }
+
+        prev_fd = pipefd[0];
+    }
+
+    if (prev_fd >= 0)
+        close(prev_fd);
+    if (out_fd >= 0)
+        close(out_fd);
+
+    // Stages that never started have finished, as far as the job goes.
+    // If the loop stopped early, the last stage never will, so the job
+    // is done, as not started, once the stages that did start are
+    if (started < n)
+    {
+        job->done = true;
+        job->status = EX_NOT_STARTED;
+    }
+    else if (!job->stages[n - 1].running)
+    {
+        job->done = true;
+        job->status = job->stages[n - 1].status;
+    }
+
+    JL_push_front(&ex.jobs, job);
+
+    ST_record(ST_LAUNCH, launch_start);
+
+    if (background)
+    {
+        int id = 1;
+        while (find_job(id) != NULL)
+            id++;
+        job->id = id;
+        job->pl = pl;
+        job->text = job_text(pl);
+
+        if (ex.interactive && job->stages[n - 1].pid > 0)
+            fprintf(stderr, "[%d] %d\n", id, (int) job->stages[n - 1].pid);
+        else if (ex.interactive)
+            fprintf(stderr, "[%d]\n", id);
+
+        // Only builtin stages need the pipeline from here on; it goes
+        // with the job once they have all finished
+        return 0;
+    }
+
+    uint64_t wait_start = ST_start();
+
+    if (inline_stage >= 0 && inline_stage < started && job->stages[inline_stage].running)
+    {
+        Stage *stage = &job->stages[inline_stage];
+        run_builtin(stage);
+        stage_finished(stage, stage->status);
+    }
+
+    // Wait for the last stage, or everything if it never started.
+    // Builtin threads use the pipeline, which the caller is about to
+    // free, so they are always waited for too.
+    for (;;)
+    {
+        bool threads = false;
+        for (int i = 0; i < n; i++)
+            threads |= job->stages[i].threaded && job->stages[i].running;
+
+        if (!threads && (started == n ? job->done : job->running == 0))
+            break;
+
+        handle_events(-1);
+    }
+
+    int result = (started == n) ? job->status : EX_NOT_STARTED;
+
+    // Any stages still running carry on as a nameless job, reaped later
+    for (int i = 0; i < n; i++)
+        job->stages[i].cmd = NULL;
+    job->detached = true;
+    handle_events(0);
+
+    ST_record(ST_WAIT, wait_start);
+    return result;
+}
+
+
+// Documented in .h file
+int EX_run_sync(Pipeline pl, int in_fd, int out_fd)
+{
+    int n = PL_length(pl);
+
+    assert(!PL_background(pl));
+    if (n == 0)
+        return 0;
+
+    int own_in = -1, own_out = -1;
+
+    if ((PL_input_file(pl) && (own_in = open_redirection(PL_input_file(pl), O_RDONLY)) < 0) ||
+        (PL_output_file(pl) &&
+         (own_out = open_redirection(PL_output_file(pl), O_WRONLY | O_CREAT | O_TRUNC)) < 0))
+    {
+        if (own_in >= 0)
+            close(own_in);
+        return 1;
+    }
+    if (own_in >= 0)
+        in_fd = own_in;
+    if (own_out >= 0)
+        out_fd = own_out;
+
+    Stage stages[n];
+    int prev_fd = in_fd;
+
+    for (int i = 0; i < n; i++)
+    {
+        stages[i] = (Stage){.cmd = PL_command(pl, i), .pid = -1, .pidfd = -1,
+                            .in_fd = -1, .out_fd = -1, .status = EX_NOT_STARTED};
+        stages[i].builtin = BI_for_command(stages[i].cmd);
+    }
+
+    // As in EX_run, except that builtins other than the last get
+    // threads that are joined here, rather than through the shell's
+    // event loop; the last runs on the calling thread
+    for (int i = 0; i < n; i++)
+    {
+        Stage *stage = &stages[i];
+        int pipefd[2] = {-1, -1};
+
+        if (i < n - 1 && pipe2(pipefd, O_CLOEXEC) < 0)
+        {
+            fprintf(stderr, "plaidsh: pipe: %s\n", strerror(errno));
+            break;
+        }
+
+        // The pipe ends this stage is given; the caller's descriptors
+        // are never given away, only copies of them
+        int own_prev = (prev_fd != in_fd) ? prev_fd : -1;
+        int own_next = pipefd[1];
+
+        if (stage->builtin != NULL && stage->builtin->shell_only)
+        {
+            fprintf(stderr, "plaidsh: %s: cannot be used here\n", stage->builtin->name);
+            stage->status = 1;
+        }
+        else if (stage->builtin != NULL)
+        {
+            // The stage takes over its descriptors
+            stage->in_fd = (own_prev >= 0) ? own_prev : fcntl(in_fd, F_DUPFD_CLOEXEC, 0);
+            stage->out_fd = (own_next >= 0) ? own_next : fcntl(out_fd, F_DUPFD_CLOEXEC, 0);
+            own_prev = own_next = -1;
+
+            if (stage->in_fd < 0 || stage->out_fd < 0)
+                fprintf(stderr, "plaidsh: %s: %s\n", stage->builtin->name, strerror(errno));
+            else if (i == n - 1)
+                stage->running = true;
+            else if (pthread_create(&stage->thread, NULL, sync_builtin_thread, stage) == 0)
+                stage->threaded = stage->running = true;
+            else
+                fprintf(stderr, "plaidsh: %s: cannot start thread\n", stage->builtin->name);
+
+            if (!stage->running)
+            {
+                if (stage->in_fd >= 0)
+                    close(stage->in_fd);
+                if (stage->out_fd >= 0)
+                    close(stage->out_fd);
+                stage->status = 1;
+            }
+        }
+        else
+            stage->pid = spawn_command(stage->cmd, prev_fd, i < n - 1 ? pipefd[1] : out_fd);
+
+        if (own_prev >= 0)
+            close(own_prev);
+        if (own_next >= 0)
+            close(own_next);
+        prev_fd = pipefd[0];
+    }
+    if (prev_fd >= 0 && prev_fd != in_fd)
+        close(prev_fd);
+
+    if (stages[n - 1].running && !stages[n - 1].threaded)
+        run_builtin(&stages[n - 1]);
+
+    for (int i = 0; i < n; i++)
+    {
+        int wstatus;
+
+        if (stages[i].threaded)
+            pthread_join(stages[i].thread, NULL);
+        else if (stages[i].pid > 0)
+        {
+            while (waitpid(stages[i].pid, &wstatus, 0) < 0 && errno == EINTR)
+                ;
+            stages[i].status = exit_status(wstatus);
+        }
+    }
+
+    int status = stages[n - 1].status;
+
+    if (own_in >= 0)
+        close(own_in);
+    if (own_out >= 0)
+        close(own_out);
+
+    return status;
+}
+
+
+// Documented in .h file
+void EX_set_interactive(bool interactive)
+{
+    ex.interactive = interactive;
+}
+
+
+// Documented in .h file
+int EX_event_fd(void)
+{
+    init_events();
+    return ex.epoll_fd;
+}
+
+
+// Documented in .h file
+void EX_reap(void)
+{
+    if (ex.epoll_fd >= 0)
+        handle_events(0);
+}
+
+
+// Documented in .h file
+int EX_notify(FILE *out)
+{
+    int count = 0;
+
+    EX_reap();
+
+    for (Job *job = JL_first(&ex.jobs), *next; job != NULL; job = next)
+    {
+        next = JL_next(&ex.jobs, job);
+
+        if (job_finished(job))
+        {
+            if (out != NULL)
+                print_job(out, job);
+            remove_job(job);
+            count++;
+        }
+    }
+
+    if (out != NULL)
+        fflush(out);
+
+    return count;
+}
+
+
+// Documented in .h file
+bool EX_jobs_finished(void)
+{
+    EX_reap();
+
+    for (Job *job = JL_first(&ex.jobs); job != NULL; job = JL_next(&ex.jobs, job))
+        if (job_finished(job))
+            return true;
+
+    return false;
+}
+
+
+// Documented in .h file
+void EX_jobs(FILE *out)
+{
+    EX_reap();
+
+    // The list is newest first; show the oldest first
+    int max = 0;
+    for (Job *job = JL_first(&ex.jobs); job != NULL; job = JL_next(&ex.jobs, job))
+        if (job->id > max)
+            max = job->id;
+
+    for (int id = 1; id <= max; id++)
+    {
+        Job *job = find_job(id);
+        if (job == NULL)
+            continue;
+
+        print_job(out, job);
+        if (job_finished(job))
+            remove_job(job);
+    }
+}
+
+
+// Documented in .h file
+int EX_wait(int id)
+{
+    int status = 0;
+
+    if (id > 0 && find_job(id) == NULL)
+        return -1;
+
+    for (;;)
+    {
+        // Collect whatever has finished, oldest first
+        Job *pending = NULL;
+
+        for (Job *job = JL_first(&ex.jobs), *next; job != NULL; job = next)
+        {
+            next = JL_next(&ex.jobs, job);
+
+            if (job->id == 0 || (id > 0 && job->id != id))
+                continue;
+
+            if (job_finished(job))
+            {
+                status = job->status;
+                remove_job(job);
+            }
+            else
+                pending = job;
+        }
+
+        if (pending == NULL)
+            return id > 0 ? status : 0;
+
+        handle_events(-1);
+    }
+}
@@ -0,0 +1,130 @@
+/*
+ * executor.h
+ *
+ * Run pipelines of commands
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#ifndef _EXECUTOR_H_
+#define _EXECUTOR_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "pipeline.h"
+
+
+/*
+ * Run a pipeline, connecting the commands with pipes and applying its
+ * redirections. A foreground pipeline is finished as soon as its last
+ * command is; any earlier commands still running are reaped later. A
+ * background pipeline becomes a job, and EX_run returns at once.
+ * Errors, such as a command that cannot be found, are reported on
+ * stderr.
+ *
+ * Parameters:
+ *   pl     The pipeline. If it runs in the background, the job takes
+ *          ownership of it and frees it when it has finished.
+ * 
+ * Returns: The exit status of the last command, or 127 if it could
+ *   not be started; 0 for a background pipeline
+ */
+int EX_run(Pipeline pl);
+
+
+/*
+ * Run a pipeline to completion on the calling thread, without making
+ * it a job. Unlike EX_run, this may be called from any thread. A
+ * builtin that ends the pipeline runs on the calling thread, and any
+ * other builtin on a thread of its own. Builtins that change the shell
+ * are refused.
+ *
+ * Parameters:
+ *   pl       The pipeline, which must not be a background pipeline
+ *   in_fd    Standard input for the pipeline, unless it redirects it
+ *   out_fd   Standard output for the pipeline, unless it redirects it
+ * 
+ * Returns: The exit status of the last command, or 127 if it could
+ *   not be started
+ */
+int EX_run_sync(Pipeline pl, int in_fd, int out_fd);
+
+
+/*
+ * Set whether the shell is interactive, in which case starting a
+ * background job reports its number and process id
+ *
+ * Parameters:
+ *   interactive  Whether the shell is interactive
+ * 
+ * Returns: None
+ */
+void EX_set_interactive(bool interactive);
+
+
+/*
+ * Returns a descriptor that becomes readable when a command of a job
+ * finishes, for use with poll. Call EX_reap when it does.
+ *
+ * Parameters: None
+ * 
+ * Returns: The descriptor
+ */
+int EX_event_fd(void);
+
+
+/*
+ * Reap any commands that have finished, without waiting
+ *
+ * Parameters: None
+ * 
+ * Returns: None
+ */
+void EX_reap(void);
+
+
+/*
+ * Check whether any background job has finished and not yet been
+ * reported
+ *
+ * Parameters: None
+ * 
+ * Returns: true if EX_notify has something to report
+ */
+bool EX_jobs_finished(void);
+
+
+/*
+ * Report the background jobs that have finished, and forget them
+ *
+ * Parameters:
+ *   out    Where to report them, or NULL to forget them silently
+ * 
+ * Returns: The number of jobs reported
+ */
+int EX_notify(FILE *out);
+
+
+/*
+ * List the background jobs. Those that have finished are forgotten.
+ *
+ * Parameters:
+ *   out    Where to list them
+ * 
+ * Returns: None
+ */
+void EX_jobs(FILE *out);
+
+
+/*
+ * Wait for background jobs to finish, and forget them
+ *
+ * Parameters:
+ *   id     The number of the job to wait for, or 0 for all of them
+ * 
+ * Returns: The exit status of the job (0 when waiting for all), or -1
+ *   if there is no such job
+ */
+int EX_wait(int id);
+
+#endif /* _EXECUTOR_H_ */
@@ -0,0 +1,488 @@
+/*
+ * histfile.c
+ *
+ * Persistent command history. Entries are lines of an append-only
+ * file, which is mapped into memory rather than read, so opening a
+ * long history costs nothing until it is searched.
+ *
+ * A second file indexes the history in blocks of HF_BLOCK_ENTRIES
+ * entries. For each block it records the block's byte range and a
+ * bitmap of the hashes of every trigram (three-byte substring) of its
+ * entries. A string can only occur in a block whose bitmap has the
+ * bits of all of the string's trigrams set, so a search reads only
+ * those blocks, plus the few entries at the end not yet in a block.
+ *
+ * Shells append under an exclusive flock on the history file, and
+ * whoever completes a block writes its index record while holding the
+ * lock. Searches take a shared lock, so they never see a record being
+ * written.
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#define _GNU_SOURCE   // for memmem and memrchr
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "histfile.h"
+
+// Entries per index block
+#define HF_BLOCK_ENTRIES 64
+
+// Bits in each block's trigram bitmap; must be a power of two
+#define HF_BITMAP_BITS 4096
+
+// Identifies an index file, and its layout version
+#define HF_MAGIC 0x31485350
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t block_entries;
+    uint32_t bitmap_bits;
+    uint32_t reserved;
+} IndexHeader;
+
+typedef struct
+{
+    uint64_t start;        // Offset of the block's first entry
+    uint64_t end;          // Offset just past its last newline
+    uint8_t bitmap[HF_BITMAP_BITS / 8];
+} IndexBlock;
+
+static struct
+{
+    int fd;                // The history file, or -1 if not open
+    int idx_fd;            // The index file
+    const char *map;       // Mapping of the history file
+    size_t map_len;
+    void *idx_map;         // Mapping of the index file
+    size_t idx_map_len;
+    const IndexBlock *blocks;
+    size_t nblocks;
+    pthread_mutex_t lock;  // Builtins may search from their own threads
+} hist = {.fd = -1, .idx_fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER};
+
+
+/*
+ * Hashes a trigram to a bit of a block bitmap
+ *
+ * Parameters:
+ *   p        The first of three bytes
+ *
+ * Returns: The bit number
+ */
+static inline uint32_t trigram_bit(const char *p)
+{
+    uint32_t t = ((uint32_t) (unsigned char) p[0] << 16) |
+                 ((uint32_t) (unsigned char) p[1] << 8) |
+                 (uint32_t) (unsigned char) p[2];
+
+    return (t * 2654435761u) >> (32 - __builtin_ctz(HF_BITMAP_BITS));
+}
+
+
+/*
+ * Sets the bits of every trigram of some text in a bitmap
+ *
+ * Parameters:
+ *   bitmap   The bitmap
+ *   text     The text
+ *   len      The length of the text
+ *
+ * Returns: None
+ */
+static void add_trigrams(uint8_t *bitmap, const char *text, size_t len)
+{
+    for (size_t i = 0; i + 3 <= len; i++)
+    {
+        uint32_t bit = trigram_bit(&text[i]);
+        bitmap[bit / 8] |= 1 << (bit % 8);
+    }
+}
+
+
+/*
+ * Brings the mappings up to date with the sizes of the files, which
+ * other shells may have extended
+ *
+ * Parameters: None
+ *
+ * Returns: true on success, false on error
+ */
+static bool remap(void)
+{
+    struct stat st, idx_st;
+
+    if (fstat(hist.fd, &st) < 0 || fstat(hist.idx_fd, &idx_st) < 0)
+        return false;
+
+    if ((size_t) st.st_size != hist.map_len)
+    {
+        if (hist.map != NULL)
+            munmap((void *) hist.map, hist.map_len);
+        hist.map = NULL;
+        hist.map_len = st.st_size;
+
+        if (hist.map_len > 0)
+        {
+            void *map = mmap(NULL, hist.map_len, PROT_READ, MAP_SHARED, hist.fd, 0);
+            if (map == MAP_FAILED)
+            {
+                hist.map_len = 0;
+                return false;
+            }
+            hist.map = map;
+        }
+    }
+
+    if ((size_t) idx_st.st_size != hist.idx_map_len)
+    {
+        if (hist.idx_map != NULL)
+            munmap(hist.idx_map, hist.idx_map_len);
+        hist.idx_map = NULL;
+        hist.idx_map_len = idx_st.st_size;
+
+        if (hist.idx_map_len > 0)
+        {
+            void *map = mmap(NULL, hist.idx_map_len, PROT_READ, MAP_SHARED, hist.idx_fd, 0);
+            if (map == MAP_FAILED)
+            {
+                hist.idx_map_len = 0;
+                return false;
+            }
+            hist.idx_map = map;
+        }
+    }
+
+    // Only trust an index built with the same layout
+    const IndexHeader *header = hist.idx_map;
+    hist.blocks = NULL;
+    hist.nblocks = 0;
+    if (hist.idx_map_len >= sizeof(IndexHeader) && header->magic == HF_MAGIC &&
+        header->block_entries == HF_BLOCK_ENTRIES && header->bitmap_bits == HF_BITMAP_BITS)
+    {
+        hist.blocks = (const IndexBlock *) (header + 1);
+        hist.nblocks = (hist.idx_map_len - sizeof(IndexHeader)) / sizeof(IndexBlock);
+    }
+
+    return true;
+}
+
+
+/*
+ * Checks whether the index matches the history file
+ *
+ * Parameters: None
+ *
+ * Returns: true if it has a valid header and does not refer past the
+ *   end of the history, which it would if the history were truncated
+ */
+static bool index_valid(void)
+{
+    if (hist.blocks == NULL)
+        return false;
+
+    return hist.nblocks == 0 || hist.blocks[hist.nblocks - 1].end <= hist.map_len;
+}
+
+
+/*
+ * Writes index records for any complete blocks of entries after the
+ * last indexed block, rebuilding the index first if it is not valid.
+ * The caller must hold the exclusive lock.
+ *
+ * Parameters: None
+ *
+ * Returns: true on success, false on error
+ */
+static bool update_index(void)
+{
+    if (!remap())
+        return false;
+
+    if (!index_valid())
+    {
+        IndexHeader header = {HF_MAGIC, HF_BLOCK_ENTRIES, HF_BITMAP_BITS, 0};
+
+        if (ftruncate(hist.idx_fd, 0) < 0 ||
+            pwrite(hist.idx_fd, &header, sizeof(header), 0) != sizeof(header) ||
+            !remap())
+            return false;
+    }
+
+    size_t pos = hist.nblocks ? hist.blocks[hist.nblocks - 1].end : 0;
+    size_t nblocks = hist.nblocks;
+    IndexBlock block;
+
+    for (;;)
+    {
+        // Find the end of the next HF_BLOCK_ENTRIES entries, if there
+        // are that many
+        memset(&block, 0, sizeof(block));
+        block.start = pos;
+
+        int n = 0;
+        while (n < HF_BLOCK_ENTRIES && pos < hist.map_len)
+        {
+            const char *nl = memchr(&hist.map[pos], '\n', hist.map_len - pos);
+            if (nl == NULL)
+                break;
+
+            size_t end = nl - hist.map;
+            add_trigrams(block.bitmap, &hist.map[pos], end - pos);
+            pos = end + 1;
+            n++;
+        }
+
+        if (n < HF_BLOCK_ENTRIES)
+            break;
+
+        block.end = pos;
+        off_t offset = sizeof(IndexHeader) + nblocks * sizeof(IndexBlock);
+        if (pwrite(hist.idx_fd, &block, sizeof(block), offset) != sizeof(block))
+            return false;
+        nblocks++;
+    }
+
+    return nblocks == hist.nblocks || remap();
+}
+
+
+/*
+ * Visits each entry in a range of the history that contains a string
+ *
+ * Parameters:
+ *   start    Offset of the first entry of the range
+ *   end      Offset just past the range
+ *   query    The string
+ *   qlen     The length of query
+ *   callback Function to call for each match
+ *   cb_data  Caller data to pass to callback
+ *
+ * Returns: The number of matching entries
+ */
+static int search_range(size_t start, size_t end, const char *query, size_t qlen,
+                        HF_callback callback, void *cb_data)
+{
+    int found = 0;
+
+    while (start < end)
+    {
+        const char *hit = memmem(&hist.map[start], end - start, query, qlen);
+        if (hit == NULL)
+            break;
+
+        // Widen the hit to its whole entry
+        const char *line = hit;
+        while (line > &hist.map[start] && line[-1] != '\n')
+            line--;
+        const char *nl = memchr(hit, '\n', &hist.map[end] - hit);
+        size_t line_end = nl ? (size_t) (nl - hist.map) : end;
+
+        // A query cannot span entries, but memmem does not know that
+        if (hit + qlen <= &hist.map[line_end])
+        {
+            callback(line, &hist.map[line_end] - line, cb_data);
+            found++;
+            start = line_end + 1;
+        }
+        else
+            start = hit - hist.map + 1;
+    }
+
+    return found;
+}
+
+
+// Documented in .h file
+bool HF_open(const char *path)
+{
+    char idx_path[4096];
+
+    if (hist.fd >= 0)
+        HF_close();
+
+    if (snprintf(idx_path, sizeof(idx_path), "%s.idx", path) >= (int) sizeof(idx_path))
+        return false;
+
+    hist.fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (hist.fd < 0)
+        return false;
+
+    hist.idx_fd = open(idx_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (hist.idx_fd < 0)
+    {
+        HF_close();
+        return false;
+    }
+
+    flock(hist.fd, LOCK_EX);
+    bool ok = update_index();
+    flock(hist.fd, LOCK_UN);
+
+    if (!ok)
+        HF_close();
+
+    return ok;
+}
+
+
+// Documented in .h file
+void HF_close(void)
+{
+    if (hist.map != NULL)
+        munmap((void *) hist.map, hist.map_len);
+    if (hist.idx_map != NULL)
+        munmap(hist.idx_map, hist.idx_map_len);
+    if (hist.fd >= 0)
+        close(hist.fd);
+    if (hist.idx_fd >= 0)
+        close(hist.idx_fd);
+
+    hist.fd = hist.idx_fd = -1;
+    hist.map = NULL;
+    hist.idx_map = NULL;
+    hist.map_len = hist.idx_map_len = 0;
+    hist.blocks = NULL;
+    hist.nblocks = 0;
+}
+
+
+// Documented in .h file
+bool HF_append(const char *line)
+{
+    if (hist.fd < 0)
+        return false;
+
+    // One write, so the entry cannot be interleaved with another
+    // shell's even without the lock
+    struct iovec iov[2] = {{(void *) line, strlen(line)}, {"\n", 1}};
+
+    pthread_mutex_lock(&hist.lock);
+    flock(hist.fd, LOCK_EX);
+
+    bool ok = writev(hist.fd, iov, 2) == (ssize_t) (iov[0].iov_len + 1);
+    if (ok)
+        ok = update_index();
+
+    flock(hist.fd, LOCK_UN);
+    pthread_mutex_unlock(&hist.lock);
+
+    return ok;
+}
+
+
+// Documented in .h file
+void HF_tail(int max, HF_callback callback, void *cb_data)
+{
+    if (hist.fd < 0 || max <= 0)
+        return;
+
+    pthread_mutex_lock(&hist.lock);
+    flock(hist.fd, LOCK_SH);
+
+    if (remap() && hist.map_len > 0)
+    {
+        // Walk back from the end, one entry at a time, to the start of
+        // the max'th last entry
+        size_t pos = hist.map_len - (hist.map[hist.map_len - 1] == '\n');
+        size_t start = pos;
+
+        for (int n = 0; n < max; n++)
+        {
+            const char *nl = pos > 0 ? memrchr(hist.map, '\n', pos) : NULL;
+            if (nl == NULL)
+            {
+                start = 0;
+                break;
+            }
+            pos = nl - hist.map;
+            start = pos + 1;
+        }
+
+        while (start < hist.map_len)
+        {
+            const char *nl = memchr(&hist.map[start], '\n', hist.map_len - start);
+            size_t end = nl ? (size_t) (nl - hist.map) : hist.map_len;
+
+            if (end > start)
+                callback(&hist.map[start], end - start, cb_data);
+            start = end + 1;
+        }
+    }
+
+    flock(hist.fd, LOCK_UN);
+    pthread_mutex_unlock(&hist.lock);
+}
+
+
+// Documented in .h file
+int HF_search(const char *query, HF_callback callback, void *cb_data)
+{
+    size_t qlen = strlen(query);
+    int found = 0;
+
+    if (hist.fd < 0 || qlen == 0)
+        return 0;
+
+    // The bits a block must have set to be worth reading, as a list of
+    // the bytes of the bitmap to check
+    uint8_t want[HF_BITMAP_BITS / 8] = {0};
+    add_trigrams(want, query, qlen);
+
+    uint16_t *check = malloc(qlen * sizeof(uint16_t));
+    if (check == NULL)
+        return 0;
+    int ncheck = 0;
+    for (int i = 0; i < (int) sizeof(want); i++)
+        if (want[i] != 0)
+            check[ncheck++] = i;
+
+    pthread_mutex_lock(&hist.lock);
+    flock(hist.fd, LOCK_SH);
+
+    if (remap())
+    {
+        size_t indexed = 0;
+
+        if (index_valid())
+        {
+            for (size_t b = 0; b < hist.nblocks; b++)
+            {
+                const IndexBlock *block = &hist.blocks[b];
+                bool possible = true;
+
+                for (int i = 0; i < ncheck && possible; i++)
+                    possible = (block->bitmap[check[i]] & want[check[i]]) == want[check[i]];
+
+                if (possible)
+                    found += search_range(block->start, block->end, query, qlen,
+                                          callback, cb_data);
+            }
+
+            if (hist.nblocks > 0)
+                indexed = hist.blocks[hist.nblocks - 1].end;
+        }
+
+        // Entries not yet in a block, or everything if the index is bad
+        found += search_range(indexed, hist.map_len, query, qlen, callback, cb_data);
+    }
+
+    flock(hist.fd, LOCK_UN);
+    pthread_mutex_unlock(&hist.lock);
+
+    free(check);
+    return found;
+}
@@ -0,0 +1,91 @@
+/*
+ * histfile.h
+ *
+ * Persistent command history, kept in an append-only file shared by
+ * every shell of the user, with an on-disk index for substring search
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#ifndef _HISTFILE_H_
+#define _HISTFILE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Called once for each history entry visited.
+ *
+ * Parameters:
+ *   line     The text of the entry, which is not nul-terminated
+ *   len      The length of the entry
+ *   cb_data  Caller data
+ */
+typedef void (*HF_callback)(const char *line, size_t len, void *cb_data);
+
+
+/*
+ * Open the history file, creating it and its index if necessary. The
+ * index is named after the file, with ".idx" added. Any entries that
+ * other shells have added without indexing are indexed now.
+ *
+ * Parameters:
+ *   path     The history file
+ *
+ * Returns: true on success; false if history cannot be kept, in which
+ *   case the other functions do nothing
+ */
+bool HF_open(const char *path);
+
+
+/*
+ * Close the history file
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+void HF_close(void);
+
+
+/*
+ * Add an entry to the end of the history. Safe against other shells
+ * appending to the same file at the same time.
+ *
+ * Parameters:
+ *   line     The entry, which must not contain a newline
+ *
+ * Returns: true on success, false on error
+ */
+bool HF_append(const char *line);
+
+
+/*
+ * Visit the most recent entries of the history, oldest first. Only the
+ * end of the file is read, however long the history is.
+ *
+ * Parameters:
+ *   max      The most entries to visit
+ *   callback Function to call for each entry
+ *   cb_data  Caller data to pass to callback
+ *
+ * Returns: None
+ */
+void HF_tail(int max, HF_callback callback, void *cb_data);
+
+
+/*
+ * Visit every entry containing a string, oldest first. Blocks of the
+ * history whose index shows they cannot contain the string are not
+ * read.
+ *
+ * Parameters:
+ *   query    The string to look for
+ *   callback Function to call for each matching entry
+ *   cb_data  Caller data to pass to callback
+ *
+ * Returns: The number of matching entries
+ */
+int HF_search(const char *query, HF_callback callback, void *cb_data);
+
+#endif /* _HISTFILE_H_ */
@@ -0,0 +1,217 @@
+/*
+ * intern.c
+ *
+ * The interned string table: open addressing with linear probing, in
+ * a power-of-two array of pointers to the strings. Each string is kept
+ * in an arena behind an InternHeader, so a probe compares hashes and
+ * lengths before it ever touches the text.
+ *
+ * Readers take no lock. A string is fully written before its slot is
+ * set, with a release store, and slots are only ever set, never
+ * cleared. When the table grows, the new array is filled before it is
+ * published, and the old one is kept, not freed, since a reader may
+ * still be probing it; the arrays kept add up to less than the one in
+ * use.
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "intern.h"
+#include "arena.h"
+
+// Number of slots in the first table; a power of two
+#define IN_INITIAL_SLOTS 1024
+
+// One array of slots
+struct in_table
+{
+    size_t mask;                  // Number of slots, less one
+    struct in_table *old;         // The table this one replaced
+    const char *slots[];          // Interned strings, or NULL
+};
+
+static struct
+{
+    struct in_table *table;       // Read without the lock
+    size_t count;                 // Strings in the table
+    Arena strings;                // Storage for the strings
+    pthread_mutex_t lock;         // Held while adding a string
+} intern = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+
+/*
+ * Hashes a string eight bytes at a time, as interning hashes every
+ * word of every line, and some words are long
+ *
+ * Parameters:
+ *   str      The string
+ *   len      The length of str
+ *
+ * Returns: The hash
+ */
+static uint32_t hash_string(const char *str, size_t len)
+{
+    const uint64_t k = 0x9e3779b97f4a7c15u;
+    uint64_t h = len * k, w;
+
+    // Four independent lanes, so long words are not one long chain of
+    // multiplies
+    if (len >= 32)
+    {
+        uint64_t lane[4] = {h, h + 1, h + 2, h + 3};
+
+        for (; len >= 32; str += 32, len -= 32)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                memcpy(&w, &str[i * 8], 8);
+                lane[i] = (lane[i] ^ w) * k;
+                lane[i] ^= lane[i] >> 29;
+            }
+        }
+
+        h = lane[0] ^ (lane[1] * 3) ^ (lane[2] * 5) ^ (lane[3] * 7);
+    }
+
+    for (; len >= 8; str += 8, len -= 8)
+    {
+        memcpy(&w, str, 8);
+        h = (h ^ w) * k;
+        h ^= h >> 29;
+    }
+
+    w = 0;
+    memcpy(&w, str, len);
+    h = (h ^ w) * k;
+    h ^= h >> 32;
+
+    return (uint32_t) h;
+}
+
+
+/*
+ * Probes a table for a string
+ *
+ * Parameters:
+ *   table    The table
+ *   str      The string
+ *   len      The length of str
+ *   hash     The hash of str
+ *   slot     Return space for the slot where the probe ended
+ *
+ * Returns: The interned copy, or NULL if it is not in the table, in
+ *   which case *slot is the empty slot where it belongs
+ */
+static const char *probe(struct in_table *table, const char *str, size_t len, uint32_t hash,
+                         size_t *slot)
+{
+    for (size_t i = hash & table->mask; ; i = (i + 1) & table->mask)
+    {
+        const char *s = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+
+        if (s == NULL || (IN_hash(s) == hash && IN_length(s) == len && memcmp(s, str, len) == 0))
+        {
+            *slot = i;
+            return s;
+        }
+    }
+}
+
+
+/*
+ * Allocates an empty table
+ *
+ * Parameters:
+ *   nslots   The number of slots; a power of two
+ *   old      The table it replaces, or NULL
+ *
+ * Returns: The table
+ */
+static struct in_table *new_table(size_t nslots, struct in_table *old)
+{
+    struct in_table *table = calloc(1, sizeof(struct in_table) + nslots * sizeof(const char *));
+    assert(table);
+
+    table->mask = nslots - 1;
+    table->old = old;
+    return table;
+}
+
+
+/*
+ * Replaces the table with one twice the size. Called with the lock held.
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+static void grow(void)
+{
+    struct in_table *old = intern.table;
+    struct in_table *table = new_table((old->mask + 1) * 2, old);
+
+    for (size_t i = 0; i <= old->mask; i++)
+    {
+        const char *s = old->slots[i];
+        if (s == NULL)
+            continue;
+
+        size_t j = IN_hash(s) & table->mask;
+        while (table->slots[j] != NULL)
+            j = (j + 1) & table->mask;
+        table->slots[j] = s;
+    }
+
+    __atomic_store_n(&intern.table, table, __ATOMIC_RELEASE);
+}
+
+
+// Documented in .h file
+const char *IN_intern(const char *str, size_t len)
+{
+    assert(len <= UINT32_MAX);
+
+    uint32_t hash = hash_string(str, len);
+    struct in_table *table = __atomic_load_n(&intern.table, __ATOMIC_ACQUIRE);
+    size_t slot;
+    const char *s;
+
+    // Almost every string is already there
+    if (table != NULL && (s = probe(table, str, len, hash, &slot)) != NULL)
+        return s;
+
+    pthread_mutex_lock(&intern.lock);
+
+    if (intern.table == NULL)
+    {
+        intern.strings = AR_new();
+        __atomic_store_n(&intern.table, new_table(IN_INITIAL_SLOTS, NULL), __ATOMIC_RELEASE);
+    }
+
+    // Another thread may have added it meanwhile
+    s = probe(intern.table, str, len, hash, &slot);
+    if (s == NULL)
+    {
+        InternHeader *header = AR_alloc(intern.strings, sizeof(InternHeader) + len + 1);
+        *header = (InternHeader){.hash = hash, .len = (uint32_t) len};
+
+        char *copy = (char *) &header[1];
+        memcpy(copy, str, len);
+        copy[len] = '\0';
+        s = copy;
+
+        __atomic_store_n(&intern.table->slots[slot], s, __ATOMIC_RELEASE);
+
+        // Kept at most half full, so probes stay short
+        if (++intern.count * 2 > intern.table->mask + 1)
+            grow();
+    }
+
+    pthread_mutex_unlock(&intern.lock);
+    return s;
+}
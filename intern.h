@@ -0,0 +1,73 @@
+/*
+ * intern.h
+ *
+ * A table of interned strings: one shared, immutable, nul-terminated
+ * copy of each distinct string, so that interned strings are equal
+ * exactly when their pointers are. Strings are never removed, so an
+ * interned pointer stays valid for the life of the shell.
+ *
+ * Any thread may intern and look up strings. Lookups take no lock;
+ * adding a string takes a mutex.
+ *
+ * The shell interns only command names (Command.name, in pipeline.h),
+ * which are looked up by pointer. Other words stay slices of their
+ * line, or copies in the line's arena, since a hash and probe per word
+ * cost the tokenizer more than it saved.
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#ifndef _INTERN_H_
+#define _INTERN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Stored in front of each interned string
+typedef struct
+{
+    uint32_t hash;      // Hash of the string
+    uint32_t len;       // Its length, without the nul
+} InternHeader;
+
+
+/*
+ * Intern a string, adding it to the table if it is not there already
+ *
+ * Parameters:
+ *   str      The string, which need not be nul-terminated
+ *   len      The length of str
+ *
+ * Returns: The interned copy
+ */
+const char *IN_intern(const char *str, size_t len);
+
+
+/*
+ * Get the hash of an interned string, without rehashing it
+ *
+ * Parameters:
+ *   interned A string returned by IN_intern
+ *
+ * Returns: The hash
+ */
+static inline uint32_t IN_hash(const char *interned)
+{
+    return ((const InternHeader *) interned)[-1].hash;
+}
+
+
+/*
+ * Get the length of an interned string, without scanning it
+ *
+ * Parameters:
+ *   interned A string returned by IN_intern
+ *
+ * Returns: The length
+ */
+static inline size_t IN_length(const char *interned)
+{
+    return ((const InternHeader *) interned)[-1].len;
+}
+
+#endif /* _INTERN_H_ */
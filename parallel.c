@@ -0,0 +1,449 @@
+/*
+ * parallel.c
+ *
+ * Run a command once for each of many inputs, several at a time.
+ *
+ * The inputs are numbered, and each worker thread starts with a
+ * contiguous share of the numbers. A worker takes inputs from the
+ * front of its own share; when that is empty, it steals one from the
+ * back of another worker's. A share is a single word holding the next
+ * and end numbers, so taking and stealing are each one compare and
+ * swap, and no locks are needed until a command's output is ready.
+ * Taking from the front keeps each worker's output roughly in input
+ * order, which keeps little output waiting when that order is wanted.
+ *
+ * Each command writes to a memfd of its own, so commands never block
+ * on a reader; once it finishes, its output is written out under a
+ * lock.
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#define _GNU_SOURCE   // for memfd_create and memmem
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "parallel.h"
+#include "arena.h"
+#include "executor.h"
+#include "pipeline.h"
+#include "Tokenize.h"
+
+// Exit status for a template that cannot be run at all
+#define PA_BAD_TEMPLATE 255
+
+// Exit status for a command that could not be started
+#define PA_NOT_STARTED 127
+
+// Largest count of failed commands reported in the exit status
+#define PA_MAX_FAILED 100
+
+// The output of one command
+typedef struct
+{
+    char *data;               // malloc'd, or NULL if there was none
+    size_t len;
+    bool done;
+} Output;
+
+struct run;
+
+// One worker thread and its share of the inputs
+typedef struct
+{
+    uint64_t tasks __attribute__((aligned(64)));   // Next input in the low
+                                                    //   half, end in the high
+    struct run *run;
+    Arena arena;              // For the command being run, reset after it
+    pthread_t thread;
+} Worker;
+
+// Everything the workers share
+typedef struct run
+{
+    Token *template;          // The template's tokens, ending with TOK_END
+    int ntokens;
+    bool substitute;          // Whether the template contains {}
+    char **inputs;
+    int ninputs;
+    int null_fd;              // Standard input for every command
+    Worker *workers;
+    int nworkers;
+    bool keep_order;
+    FILE *out;
+    pthread_mutex_t out_lock; // Protects everything below
+    Output *outputs;          // Held back until earlier inputs finish,
+    int next_out;             //   if keep_order is set
+    int failed;
+} Run;
+
+
+/*
+ * Builds the tokens for one command, putting an input into the template
+ *
+ * Parameters:
+ *   run      The run
+ *   input    The input
+ *   arena    Arena for the tokens
+ *
+ * Returns: The tokens
+ */
+static CList instantiate(const Run *run, const char *input, Arena arena)
+{
+    CList tokens = CL_new_in(arena);
+    size_t input_len = strlen(input);
+
+    for (int i = 0; i < run->ntokens; i++)
+    {
+        Token token = run->template[i];
+
+        if (token.type == TOK_END && !run->substitute)
+            CL_append(tokens, (Token){TOK_QUOTED_WORD, false, input, input_len});
+
+        if ((token.type == TOK_WORD || token.type == TOK_QUOTED_WORD) &&
+            memmem(token.text, token.len, "{}", 2) != NULL)
+        {
+            // Allow for every character of the word being replaced
+            char *text = AR_alloc(arena, token.len / 2 * input_len + token.len + 1);
+            size_t len = 0;
+
+            for (size_t j = 0; j < token.len; j++)
+            {
+                if (j + 1 < token.len && token.text[j] == '{' && token.text[j + 1] == '}')
+                {
+                    memcpy(&text[len], input, input_len);
+                    len += input_len;
+                    j++;
+                }
+                else
+                    text[len++] = token.text[j];
+            }
+
+            // The input is never split, globbed or taken as an operator
+            token = (Token){TOK_QUOTED_WORD, false, text, len};
+        }
+
+        CL_append(tokens, token);
+    }
+
+    return tokens;
+}
+
+
+/*
+ * Writes out whatever output is ready, with the output lock held
+ *
+ * Parameters:
+ *   run      The run
+ *
+ * Returns: None
+ */
+static void flush_outputs(Run *run)
+{
+    while (run->next_out < run->ninputs && run->outputs[run->next_out].done)
+    {
+        Output *output = &run->outputs[run->next_out++];
+
+        fwrite(output->data, 1, output->len, run->out);
+        free(output->data);
+        output->data = NULL;
+    }
+    fflush(run->out);
+}
+
+
+/*
+ * Reads back the output a command wrote to a memfd
+ *
+ * Parameters:
+ *   fd       The memfd
+ *   output   Where to store the output
+ *
+ * Returns: None
+ */
+static void collect_output(int fd, Output *output)
+{
+    off_t size = lseek(fd, 0, SEEK_END);
+
+    output->data = NULL;
+    output->len = 0;
+    if (size <= 0)
+        return;
+
+    output->data = malloc(size);
+    assert(output->data);
+
+    while (output->len < (size_t) size)
+    {
+        ssize_t got = pread(fd, output->data + output->len, size - output->len, output->len);
+        if (got <= 0)
+            break;
+        output->len += got;
+    }
+}
+
+
+/*
+ * Runs the command for one input and writes out its output
+ *
+ * Parameters:
+ *   worker   The worker running it
+ *   task     The number of the input
+ *
+ * Returns: None
+ */
+static void run_task(Worker *worker, int task)
+{
+    Run *run = worker->run;
+    const char *input = run->inputs[task];
+    char errmsg[256];
+    int status = PA_NOT_STARTED;
+    Output output = {NULL, 0, true};
+
+    Pipeline pl = PL_parse(instantiate(run, input, worker->arena), worker->arena,
+                           errmsg, sizeof(errmsg));
+    int fd = memfd_create("parallel", MFD_CLOEXEC);
+
+    if (pl == NULL)
+        fprintf(stderr, "parallel: %s: %s\n", input, errmsg);
+    else if (fd < 0)
+        fprintf(stderr, "parallel: memfd: %s\n", strerror(errno));
+    else
+    {
+        status = EX_run_sync(pl, run->null_fd, fd);
+        collect_output(fd, &output);
+    }
+
+    if (fd >= 0)
+        close(fd);
+    AR_reset(worker->arena);
+
+    // Failures to start have been reported already
+    if (pl != NULL && fd >= 0 && status != 0)
+        fprintf(stderr, "parallel: %s: exit status %d\n", input, status);
+
+    pthread_mutex_lock(&run->out_lock);
+
+    if (status != 0)
+        run->failed++;
+
+    if (run->keep_order)
+    {
+        run->outputs[task] = output;
+        flush_outputs(run);
+    }
+    else
+    {
+        fwrite(output.data, 1, output.len, run->out);
+        fflush(run->out);
+        free(output.data);
+    }
+
+    pthread_mutex_unlock(&run->out_lock);
+}
+
+
+// Packs a share of the inputs into one word
+static uint64_t pack_tasks(uint32_t next, uint32_t end)
+{
+    return (uint64_t) end << 32 | next;
+}
+
+
+/*
+ * Takes an input from a worker's share
+ *
+ * Parameters:
+ *   worker   The worker whose share to take from
+ *   steal    Whether to take from the back, as another worker
+ *
+ * Returns: The number of the input, or -1 if the share is empty
+ */
+static int take_task(Worker *worker, bool steal)
+{
+    uint64_t tasks = __atomic_load_n(&worker->tasks, __ATOMIC_ACQUIRE);
+
+    for (;;)
+    {
+        uint32_t next = (uint32_t) tasks, end = (uint32_t) (tasks >> 32);
+
+        if (next >= end)
+            return -1;
+
+        uint64_t taken = steal ? pack_tasks(next, end - 1) : pack_tasks(next + 1, end);
+        if (__atomic_compare_exchange_n(&worker->tasks, &tasks, taken, true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return steal ? (int) end - 1 : (int) next;
+    }
+}
+
+
+// pthread entry point for a worker; also run on the calling thread
+static void *worker_main(void *arg)
+{
+    Worker *worker = arg;
+    Run *run = worker->run;
+    int self = worker - run->workers;
+
+    for (;;)
+    {
+        int task = take_task(worker, false);
+
+        // Nothing left of our own share: steal from the others
+        for (int i = 1; task < 0 && i < run->nworkers; i++)
+            task = take_task(&run->workers[(self + i) % run->nworkers], true);
+
+        if (task < 0)
+            return NULL;
+
+        run_task(worker, task);
+    }
+}
+
+
+/*
+ * Tokenizes the template and checks that it makes a command
+ *
+ * Parameters:
+ *   run        The run, whose template is filled in
+ *   template   The words of the template
+ *   ntemplate  The number of words
+ *   arena      Arena for the tokens
+ *
+ * Returns: true if the template is valid, false after reporting an error
+ */
+static bool prepare_template(Run *run, char **template, int ntemplate, Arena arena)
+{
+    char errmsg[256];
+    CList tokens;
+
+    if (ntemplate == 1)
+    {
+        tokens = TOK_tokenize_input(template[0], arena, errmsg, sizeof(errmsg));
+        if (tokens == NULL)
+        {
+            fprintf(stderr, "parallel: %s\n", errmsg);
+            return false;
+        }
+    }
+    else
+    {
+        tokens = CL_new_in(arena);
+        for (int i = 0; i < ntemplate; i++)
+            CL_append(tokens, (Token){TOK_QUOTED_WORD, false, template[i], strlen(template[i])});
+        CL_append(tokens, (Token){TOK_END, false, "", 0});
+    }
+
+    run->ntokens = CL_length(tokens);
+    run->template = AR_alloc(arena, run->ntokens * sizeof(Token));
+    run->substitute = false;
+    for (int i = 0; i < run->ntokens; i++)
+    {
+        run->template[i] = CL_pop(tokens);
+        if (memmem(run->template[i].text, run->template[i].len, "{}", 2) != NULL)
+            run->substitute = true;
+    }
+
+    // Errors in the template are reported once, not once per input
+    Pipeline pl = PL_parse(instantiate(run, "", arena), arena, errmsg, sizeof(errmsg));
+    if (pl == NULL)
+    {
+        fprintf(stderr, "parallel: %s\n", errmsg);
+        return false;
+    }
+
+    bool valid = !PL_background(pl) && PL_length(pl) > 0;
+    if (PL_background(pl))
+        PL_free(pl);
+    if (!valid)
+        fprintf(stderr, "parallel: the command cannot be empty or end with &\n");
+
+    return valid;
+}
+
+
+// Documented in .h file
+int PA_run(char **template, int ntemplate, char **inputs, int ninputs,
+           int njobs, bool keep_order, FILE *out)
+{
+    assert(ntemplate > 0 && njobs > 0);
+
+    Arena arena = AR_new();
+    Run run = {.inputs = inputs, .ninputs = ninputs, .keep_order = keep_order, .out = out};
+
+    if (!prepare_template(&run, template, ntemplate, arena))
+    {
+        AR_free(arena);
+        return PA_BAD_TEMPLATE;
+    }
+
+    if (ninputs == 0)
+    {
+        AR_free(arena);
+        return 0;
+    }
+
+    if ((run.null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC)) < 0)
+    {
+        fprintf(stderr, "parallel: /dev/null: %s\n", strerror(errno));
+        AR_free(arena);
+        return PA_BAD_TEMPLATE;
+    }
+
+    run.nworkers = (njobs < ninputs) ? njobs : ninputs;
+    run.workers = aligned_alloc(64, run.nworkers * sizeof(Worker));
+    run.outputs = calloc(ninputs, sizeof(Output));
+    assert(run.workers && run.outputs);
+    pthread_mutex_init(&run.out_lock, NULL);
+
+    for (int i = 0; i < run.nworkers; i++)
+    {
+        Worker *worker = &run.workers[i];
+
+        worker->tasks = pack_tasks((int64_t) ninputs * i / run.nworkers,
+                                   (int64_t) ninputs * (i + 1) / run.nworkers);
+        worker->run = &run;
+        worker->arena = AR_new();
+    }
+
+    // The calling thread is the first worker
+    int started = 1;
+    for (; started < run.nworkers; started++)
+    {
+        if (pthread_create(&run.workers[started].thread, NULL, worker_main,
+                           &run.workers[started]) != 0)
+            break;   // the rest of its share will be stolen
+    }
+    worker_main(&run.workers[0]);
+
+    for (int i = 1; i < started; i++)
+        pthread_join(run.workers[i].thread, NULL);
+
+    // Shares of workers that failed to start are still there
+    for (int i = started; i < run.nworkers; i++)
+    {
+        int task;
+        while ((task = take_task(&run.workers[i], false)) >= 0)
+            run_task(&run.workers[0], task);
+    }
+
+    for (int i = 0; i < run.nworkers; i++)
+        AR_free(run.workers[i].arena);
+
+    pthread_mutex_destroy(&run.out_lock);
+    free(run.outputs);
+    free(run.workers);
+    close(run.null_fd);
+    AR_free(arena);
+
+    return (run.failed > PA_MAX_FAILED) ? PA_MAX_FAILED + 1 : run.failed;
+}
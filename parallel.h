@@ -0,0 +1,45 @@
+/*
+ * parallel.h
+ *
+ * Run a command once for each of many inputs, several at a time, for
+ * the parallel builtin
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+
+/*
+ * Run a command template once for each input, with up to njobs
+ * commands running at once. Each "{}" in the template is replaced by
+ * the input; if there is none, the input is added as a final
+ * argument. A template of a single word is tokenized as a command
+ * line, so it may contain pipes and redirections.
+ *
+ * The output of each command is collected and written to out in one
+ * piece when the command finishes, in the order the commands finish,
+ * or in the order of the inputs if keep_order is set. Commands whose
+ * exit status is not 0 are reported on stderr.
+ *
+ * Parameters:
+ *   template    The words of the command template
+ *   ntemplate   The number of words
+ *   inputs      The inputs
+ *   ninputs     The number of inputs
+ *   njobs       The most commands to run at once
+ *   keep_order  Whether to write the output in the order of the inputs
+ *   out         Where to write the output
+ * 
+ * Returns: 0 if every command succeeded; otherwise the number of
+ *   commands that failed, up to 100, or 101 if more failed; 255 if the
+ *   template is not a valid command
+ */
+int PA_run(char **template, int ntemplate, char **inputs, int ninputs,
+           int njobs, bool keep_order, FILE *out);
+
+#endif /* _PARALLEL_H_ */
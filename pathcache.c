@@ -0,0 +1,364 @@
+/*
+ * pathcache.c
+ *
+ * A cache mapping command names to their absolute paths, similar to
+ * the hash builtin of other shells. Entries are keyed by the interned
+ * name, so a hit costs pointer comparisons in the bucket given by the
+ * hash stored with the name, plus, at most once a second per
+ * directory, a stat of the directories that were searched to find the
+ * command; a miss searches $PATH once.
+ *
+ * The cache is shared by every thread that launches commands, and is
+ * protected by one mutex; a lookup holds it only briefly.
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "pathcache.h"
+#include "env.h"
+#include "intern.h"
+
+#define PC_NBUCKETS 256
+
+// How long a directory's modification time is trusted before it is
+// checked again, in nanoseconds
+#define PC_RECHECK_NS 1000000000LL
+
+// Search path used when $PATH is not set
+#define PC_DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+
+// One directory of $PATH
+typedef struct
+{
+    char *path;
+    bool relative;            // Results from relative dirs are not cached
+    bool known;               // Whether mtime has been recorded
+    struct timespec mtime;    // Modification time when last checked
+    int64_t checked;          // When mtime was last checked
+} PathDir;
+
+// One cached command
+struct pc_entry
+{
+    const char *name;         // Interned
+    char *path;
+    int dir;                  // Index of the directory it was found in
+    unsigned hits;
+    struct pc_entry *next;
+};
+
+static struct
+{
+    char *path_var;           // The $PATH that dirs was built from
+    PathDir *dirs;
+    int ndirs;
+    struct pc_entry *buckets[PC_NBUCKETS];
+    pthread_mutex_t lock;
+} cache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+
+/*
+ * Returns the current time from the monotonic clock
+ *
+ * Parameters: None
+ * 
+ * Returns: The time, in nanoseconds
+ */
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/*
+ * Discards the cached entries, but not the parsed $PATH
+ *
+ * Parameters: None
+ * 
+ * Returns: None
+ */
+static void clear_entries(void)
+{
+    for (int b = 0; b < PC_NBUCKETS; b++)
+    {
+        struct pc_entry *e = cache.buckets[b];
+        while (e != NULL)
+        {
+            struct pc_entry *next = e->next;
+            free(e->path);
+            free(e);
+            e = next;
+        }
+        cache.buckets[b] = NULL;
+    }
+}
+
+
+/*
+ * Discards every cached entry and the parsed $PATH
+ *
+ * Parameters: None
+ * 
+ * Returns: None
+ */
+static void forget_path(void)
+{
+    clear_entries();
+
+    for (int d = 0; d < cache.ndirs; d++)
+        free(cache.dirs[d].path);
+    free(cache.dirs);
+    free(cache.path_var);
+
+    cache.dirs = NULL;
+    cache.ndirs = 0;
+    cache.path_var = NULL;
+}
+
+
+/*
+ * Makes sure the list of directories matches the current $PATH,
+ * discarding everything if it has changed
+ *
+ * Parameters: None
+ * 
+ * Returns: None
+ */
+static void sync_path(void)
+{
+    EN_read_lock();
+
+    const char *path_var = EN_get("PATH");
+    if (path_var == NULL)
+        path_var = PC_DEFAULT_PATH;
+
+    bool same = cache.path_var != NULL && strcmp(cache.path_var, path_var) == 0;
+    if (!same)
+    {
+        forget_path();
+        cache.path_var = strdup(path_var);
+    }
+
+    EN_read_unlock();
+
+    if (same)
+        return;
+    assert(cache.path_var);
+    path_var = cache.path_var;
+
+    // one directory per colon-separated component
+    int ndirs = 1;
+    for (const char *p = path_var; *p; p++)
+        if (*p == ':')
+            ndirs++;
+
+    cache.dirs = calloc(ndirs, sizeof(PathDir));
+    assert(cache.dirs);
+
+    const char *start = path_var;
+    for (int i = 0; i < ndirs; i++)
+    {
+        size_t len = strcspn(start, ":");
+
+        // an empty component means the current directory
+        cache.dirs[i].path = (len == 0) ? strdup(".") : strndup(start, len);
+        assert(cache.dirs[i].path);
+        cache.dirs[i].relative = (cache.dirs[i].path[0] != '/');
+
+        start += len + 1;
+    }
+    cache.ndirs = ndirs;
+}
+
+
+/*
+ * Checks whether a directory may have changed since it was last
+ * checked, recording its current modification time. A directory seen
+ * for the first time counts as unchanged, as nothing cached yet
+ * depends on it.
+ *
+ * Parameters:
+ *   dir      The directory
+ *   now      The current time
+ * 
+ * Returns: true if the directory has not changed
+ */
+static bool dir_unchanged(PathDir *dir, int64_t now)
+{
+    if (dir->known && now - dir->checked < PC_RECHECK_NS)
+        return true;
+
+    struct stat st;
+    struct timespec mtime = {0, 0};
+    if (stat(dir->path, &st) == 0)
+        mtime = st.st_mtim;
+
+    bool unchanged = !dir->known || (mtime.tv_sec == dir->mtime.tv_sec &&
+                                     mtime.tv_nsec == dir->mtime.tv_nsec);
+
+    dir->known = true;
+    dir->mtime = mtime;
+    dir->checked = now;
+
+    return unchanged;
+}
+
+
+/*
+ * Copies a string into a caller's buffer
+ *
+ * Parameters:
+ *   src      The string
+ *   dst      The buffer
+ *   dst_sz   The size of dst
+ * 
+ * Returns: true if src fit, false otherwise
+ */
+static bool copy_out(const char *src, char *dst, size_t dst_sz)
+{
+    return (size_t) snprintf(dst, dst_sz, "%s", src) < dst_sz;
+}
+
+
+/*
+ * Looks up a command name without a slash, with the cache locked
+ *
+ * Parameters:
+ *   name     The command name, interned
+ *   path     Return space for the path
+ *   path_sz  The size of path
+ * 
+ * Returns: true if an executable was found, false otherwise
+ */
+static bool lookup_locked(const char *name, char *path, size_t path_sz)
+{
+    sync_path();
+
+    int64_t now = now_ns();
+    unsigned b = IN_hash(name) % PC_NBUCKETS;
+
+    for (struct pc_entry *e = cache.buckets[b]; e != NULL; e = e->next)
+    {
+        if (e->name != name)
+            continue;
+
+        // A change to any directory searched before finding the
+        // command could have added or removed a match
+        bool valid = true;
+        for (int d = 0; d <= e->dir; d++)
+            valid = dir_unchanged(&cache.dirs[d], now) && valid;
+
+        if (valid)
+        {
+            e->hits++;
+            return copy_out(e->path, path, path_sz);
+        }
+
+        clear_entries();
+        break;
+    }
+
+    // Miss: search $PATH
+    bool changed = false;
+    for (int d = 0; d < cache.ndirs; d++)
+    {
+        PathDir *dir = &cache.dirs[d];
+        if (!dir->relative && !dir_unchanged(dir, now))
+            changed = true;
+
+        char candidate[4096];
+        if ((size_t) snprintf(candidate, sizeof(candidate), "%s/%s", dir->path, name) >= sizeof(candidate))
+            continue;
+
+        struct stat st;
+        if (stat(candidate, &st) != 0 || !S_ISREG(st.st_mode) || (st.st_mode & 0111) == 0)
+            continue;
+
+        if (changed)
+            clear_entries();   // entries found through this dir are stale
+
+        if (!dir->relative)
+        {
+            struct pc_entry *e = malloc(sizeof(struct pc_entry));
+            assert(e);
+            e->name = name;
+            e->path = strdup(candidate);
+            assert(e->path);
+            e->dir = d;
+            e->hits = 1;
+            e->next = cache.buckets[b];
+            cache.buckets[b] = e;
+        }
+
+        return copy_out(candidate, path, path_sz);
+    }
+
+    if (changed)
+        clear_entries();
+
+    return false;
+}
+
+
+// Documented in .h file
+bool PC_lookup(const char *name, char *path, size_t path_sz)
+{
+    assert(name);
+
+    if (strchr(name, '/') != NULL)
+        return copy_out(name, path, path_sz);
+
+    if (*name == '\0')
+        return false;
+
+    pthread_mutex_lock(&cache.lock);
+    bool found = lookup_locked(name, path, path_sz);
+    pthread_mutex_unlock(&cache.lock);
+
+    return found;
+}
+
+
+// Documented in .h file
+void PC_clear(void)
+{
+    pthread_mutex_lock(&cache.lock);
+    forget_path();
+    pthread_mutex_unlock(&cache.lock);
+}
+
+
+// Documented in .h file
+void PC_print(FILE *out)
+{
+    bool empty = true;
+
+    pthread_mutex_lock(&cache.lock);
+
+    for (int b = 0; b < PC_NBUCKETS; b++)
+    {
+        for (struct pc_entry *e = cache.buckets[b]; e != NULL; e = e->next)
+        {
+            if (empty)
+                fprintf(out, "hits\tcommand\n");
+            empty = false;
+            fprintf(out, "%4u\t%s\n", e->hits, e->path);
+        }
+    }
+
+    pthread_mutex_unlock(&cache.lock);
+
+    if (empty)
+        fprintf(out, "hash: hash table empty\n");
+}
@@ -0,0 +1,56 @@
+/*
+ * pathcache.h
+ *
+ * A cache mapping command names to their absolute paths, so that each
+ * launch does not have to search every $PATH directory. The functions
+ * may be called from any thread.
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#ifndef _PATHCACHE_H_
+#define _PATHCACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+
+/*
+ * Find the executable a command name refers to. Names containing a
+ * slash are not searched for, and are returned unchanged. Otherwise
+ * the cached path is used if there is one and it is still valid;
+ * cached paths are discarded when $PATH changes, or when the
+ * modification time of a directory searched to find them changes.
+ *
+ * Parameters:
+ *   name     The command name, interned (see intern.h)
+ *   path     Return space for the path
+ *   path_sz  The size of path
+ * 
+ * Returns: true if an executable was found, false otherwise
+ */
+bool PC_lookup(const char *name, char *path, size_t path_sz);
+
+
+/*
+ * Discard every cached path
+ *
+ * Parameters: None
+ * 
+ * Returns: None
+ */
+void PC_clear(void);
+
+
+/*
+ * Print the cached paths, with the number of times each has been used
+ *
+ * Parameters:
+ *   out      Where to print
+ * 
+ * Returns: None
+ */
+void PC_print(FILE *out);
+
+#endif /* _PATHCACHE_H_ */
@@ -0,0 +1,362 @@
+/*
+ * pipeline.c
+ *
+ * Parse a list of tokens into a pipeline of commands
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "pipeline.h"
+#include "Tokenize.h"
+#include "wildcard.h"
+#include "intern.h"
+#include "container.h"
+
+VEC_DECLARE(CommandVec, CV, Command)
+
+struct _pipeline
+{
+    CommandVec commands;
+    char *input_file;     // Redirection for the first command, or NULL
+    char *output_file;    // Redirection for the last command, or NULL
+    bool background;      // Whether the line ended with &
+    Arena arena;          // Storage for all of the above, or NULL for malloc
+};
+
+
+/*
+ * Allocates memory that belongs to a pipeline
+ *
+ * Parameters:
+ *   pl         The pipeline
+ *   size       The number of bytes needed
+ * 
+ * Returns: The memory, from the pipeline's arena if it has one
+ */
+static void *pl_alloc(Pipeline pl, size_t size)
+{
+    void *ptr = pl->arena ? AR_alloc(pl->arena, size) : malloc(size);
+    assert(ptr);
+    return ptr;
+}
+
+
+/*
+ * Records a redirection, checking that it does not conflict with an
+ * earlier one
+ *
+ * Parameters:
+ *   pl         The pipeline
+ *   cur        The cursor, positioned at the redirection operator
+ *   file       Where to store the filename
+ *   allowed    Whether this command may redirect in this direction
+ *   errmsg     Return space for an error message
+ *   errmsg_sz  The size of errmsg
+ * 
+ * Returns: true on success, false on error
+ */
+static bool parse_redirection(Pipeline pl, TokCursor *cur, char **file, bool allowed,
+                              char *errmsg, size_t errmsg_sz)
+{
+    TokenType filename_type = TOK_peek_type(cur, 1);
+
+    if (filename_type != TOK_WORD && filename_type != TOK_QUOTED_WORD)
+    {
+        snprintf(errmsg, errmsg_sz, "Expect filename after redirection");
+        return false;
+    }
+
+    if (*file != NULL || !allowed)
+    {
+        snprintf(errmsg, errmsg_sz, "Multiple redirection");
+        return false;
+    }
+
+    Token filename = TOK_peek(cur, 1);
+    *file = pl_alloc(pl, filename.len + 1);
+    memcpy(*file, filename.text, filename.len);
+    (*file)[filename.len] = '\0';
+    TOK_advance(cur);
+    TOK_advance(cur);
+    return true;
+}
+
+
+// The expansions of the wildcard words of one command, in order
+typedef struct
+{
+    char **matches;    // As returned by GL_expand; NULL if none
+    int n;
+} Expansion;
+
+
+/*
+ * Checks whether a token is subject to filename expansion. Quoted
+ * words never are.
+ *
+ * Parameters:
+ *   token      The token
+ * 
+ * Returns: true if the token is an unquoted word containing wildcards
+ */
+static bool is_glob_word(Token token)
+{
+    return token.type == TOK_WORD && GL_is_pattern(token.text, token.len);
+}
+
+
+/*
+ * Parses one command, up to the next pipe or the end of the tokens,
+ * and appends it to the pipeline. The argument vector is built in a
+ * single allocation: the pointers, followed by the strings.
+ *
+ * Parameters:
+ *   pl         The pipeline
+ *   cur        The cursor, positioned at the start of the command
+ *   globs      Directory cache for filename expansion
+ *   errmsg     Return space for an error message
+ *   errmsg_sz  The size of errmsg
+ * 
+ * Returns: true on success, false on error
+ */
+static bool parse_command(Pipeline pl, TokCursor *cur, GlobCache globs, char *errmsg, size_t errmsg_sz)
+{
+    int start = TOK_mark(cur);
+    int argc = 0;
+    size_t bytes = 0;
+    Expansion *expansions = NULL;
+    int nexpansions = 0;
+
+    // First pass: size the arguments and pick up redirections
+    for (;;)
+    {
+        Token token = TOK_peek(cur, 0);
+
+        Expansion exp = {NULL, 0};
+
+        if (is_glob_word(token))
+        {
+            char *pattern = TOK_strdup(token);
+            exp.n = GL_expand(globs, pattern, &exp.matches);
+            free(pattern);
+
+            expansions = realloc(expansions, (nexpansions + 1) * sizeof(Expansion));
+            assert(expansions);
+            expansions[nexpansions++] = exp;
+        }
+
+        if (exp.n > 0)
+        {
+            argc += exp.n;
+            for (int i = 0; i < exp.n; i++)
+                bytes += strlen(exp.matches[i]) + 1;
+            TOK_advance(cur);
+        }
+        else if (token.type == TOK_WORD || token.type == TOK_QUOTED_WORD)
+        {
+            // Including patterns that matched nothing, which are kept as is
+            argc++;
+            bytes += token.len + 1;
+            TOK_advance(cur);
+        }
+        else if (token.type == TOK_LESSTHAN)
+        {
+            // Only the first command reads from anything but a pipe
+            if (!parse_redirection(pl, cur, &pl->input_file, CV_length(&pl->commands) == 0, errmsg, errmsg_sz))
+                goto fail;
+        }
+        else if (token.type == TOK_GREATERTHAN)
+        {
+            if (!parse_redirection(pl, cur, &pl->output_file, true, errmsg, errmsg_sz))
+                goto fail;
+        }
+        else
+            break;
+    }
+
+    if (argc == 0)
+    {
+        snprintf(errmsg, errmsg_sz, "No command specified");
+        goto fail;
+    }
+
+    // Second pass: copy the words into the argument vector
+    char **argv = pl_alloc(pl, (argc + 1) * sizeof(char *) + bytes);
+    char *strings = (char *) &argv[argc + 1];
+
+    int end = TOK_mark(cur);
+    TOK_reset(cur, start);
+    for (int i = 0, e = 0; TOK_mark(cur) < end; TOK_advance(cur))
+    {
+        Token token = TOK_peek(cur, 0);
+
+        if (token.type == TOK_LESSTHAN || token.type == TOK_GREATERTHAN)
+        {
+            TOK_advance(cur);   // skip the filename too
+            continue;
+        }
+
+        if (is_glob_word(token) && expansions[e++].n > 0)
+        {
+            for (char **match = expansions[e - 1].matches; *match; match++)
+            {
+                size_t len = strlen(*match);
+                argv[i++] = strings;
+                memcpy(strings, *match, len + 1);
+                strings += len + 1;
+            }
+            continue;
+        }
+
+        argv[i++] = strings;
+        memcpy(strings, token.text, token.len);
+        strings[token.len] = '\0';
+        strings += token.len + 1;
+    }
+    argv[argc] = NULL;
+
+    // Interned, so the builtin and PATH lookups compare pointers
+    const char *name = IN_intern(argv[0], strlen(argv[0]));
+    *CV_append(&pl->commands) = (Command){.argc = argc, .argv = argv, .name = name};
+
+    for (int e = 0; e < nexpansions; e++)
+        free(expansions[e].matches);
+    free(expansions);
+    return true;
+
+fail:
+    for (int e = 0; e < nexpansions; e++)
+        free(expansions[e].matches);
+    free(expansions);
+    return false;
+}
+
+
+// Documented in .h file
+Pipeline PL_parse(CList tokens, Arena arena, char *errmsg, size_t errmsg_sz)
+{
+    // A background job outlives the command that started it
+    int ntokens = CL_length(tokens);
+    if (ntokens >= 2 && CL_nth(tokens, ntokens - 2).type == TOK_AMPERSAND)
+        arena = NULL;
+
+    Pipeline pl;
+    if (arena)
+        pl = memset(AR_alloc(arena, sizeof(struct _pipeline)), 0, sizeof(struct _pipeline));
+    else
+        pl = calloc(1, sizeof(struct _pipeline));
+    assert(pl);
+    pl->arena = arena;
+    CV_init(&pl->commands, arena);
+
+    TokCursor cur = TOK_cursor(tokens);
+
+    if (TOK_peek_type(&cur, 0) == TOK_END)
+        return pl;   // empty line
+
+    // Directories read for filename expansion are reused for the rest
+    // of the line
+    GlobCache globs = GL_cache_new();
+
+    for (;;)
+    {
+        if (!parse_command(pl, &cur, globs, errmsg, errmsg_sz))
+        {
+            GL_cache_free(globs);
+            PL_free(pl);
+            return NULL;
+        }
+
+        if (TOK_peek_type(&cur, 0) != TOK_PIPE)
+            break;
+
+        // Only the last command writes to anything but a pipe
+        if (pl->output_file != NULL)
+        {
+            snprintf(errmsg, errmsg_sz, "Multiple redirection");
+            GL_cache_free(globs);
+            PL_free(pl);
+            return NULL;
+        }
+        TOK_advance(&cur);
+    }
+
+    GL_cache_free(globs);
+
+    if (TOK_peek_type(&cur, 0) == TOK_AMPERSAND)
+    {
+        pl->background = true;
+        TOK_advance(&cur);
+    }
+
+    if (TOK_peek_type(&cur, 0) != TOK_END)
+    {
+        snprintf(errmsg, errmsg_sz, "Expect end of command after &");
+        PL_free(pl);
+        return NULL;
+    }
+
+    return pl;
+}
+
+
+// Documented in .h file
+void PL_free(Pipeline pl)
+{
+    // A pipeline in an arena goes away when the arena is reset
+    if (pl == NULL || pl->arena)
+        return;
+
+    for (int i = 0; i < CV_length(&pl->commands); i++)
+        free(CV_at(&pl->commands, i)->argv);
+
+    CV_free(&pl->commands);
+    free(pl->input_file);
+    free(pl->output_file);
+    free(pl);
+}
+
+
+// Documented in .h file
+int PL_length(Pipeline pl)
+{
+    assert(pl);
+    return CV_length(&pl->commands);
+}
+
+
+// Documented in .h file
+const Command *PL_command(Pipeline pl, int pos)
+{
+    assert(pl);
+    return CV_at(&pl->commands, pos);
+}
+
+
+// Documented in .h file
+bool PL_background(Pipeline pl)
+{
+    assert(pl);
+    return pl->background;
+}
+
+
+// Documented in .h file
+const char *PL_input_file(Pipeline pl)
+{
+    assert(pl);
+    return pl->input_file;
+}
+
+
+// Documented in .h file
+const char *PL_output_file(Pipeline pl)
+{
+    assert(pl);
+    return pl->output_file;
+}
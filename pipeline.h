@@ -0,0 +1,116 @@
+/*
+ * pipeline.h
+ *
+ * Parse a list of tokens into a pipeline of commands
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <stddef.h>
+#include "clist.h"
+#include "arena.h"
+
+// One stage of a pipeline
+typedef struct
+{
+    int argc;       // Number of arguments, including the command name
+    char **argv;    // argc arguments followed by NULL
+    const char *name;   // argv[0], interned (see intern.h)
+} Command;
+
+// struct _pipeline is defined in .c file
+typedef struct _pipeline *Pipeline;
+
+
+/*
+ * Parse a list of tokens, as returned by TOK_tokenize_input, into a
+ * pipeline. The tokens are not modified.
+ *
+ * Parameters:
+ *   tokens     The list of tokens
+ *   arena      Arena to build the pipeline in, or NULL to use malloc
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ * 
+ * Returns: A newly-created pipeline, which may contain no commands if
+ *   tokens was empty. If the tokens do not form a valid pipeline,
+ *   copies an error message into errmsg and returns NULL.
+ *
+ *   The pipeline does not refer to the tokens once built. It is up to
+ *   the caller to call PL_free on the returned pipeline, or to reset
+ *   the arena. A background pipeline (one ending with &) is never
+ *   allocated from the arena, since it outlives the command.
+ */
+Pipeline PL_parse(CList tokens, Arena arena, char *errmsg, size_t errmsg_sz);
+
+
+/*
+ * Destroy a pipeline, calling free() on all malloc'd memory.
+ *
+ * Parameters:
+ *   pl     The pipeline; if NULL, no action will occur
+ * 
+ * Returns: None
+ */
+void PL_free(Pipeline pl);
+
+
+/*
+ * Returns the number of commands in a pipeline
+ *
+ * Parameters:
+ *   pl     The pipeline
+ * 
+ * Returns: The number of commands, which is 0 for an empty line
+ */
+int PL_length(Pipeline pl);
+
+
+/*
+ * Returns one command of a pipeline
+ *
+ * Parameters:
+ *   pl     The pipeline
+ *   pos    Position of the command, counting 0 as the first
+ * 
+ * Returns: The command, which remains owned by the pipeline
+ */
+const Command *PL_command(Pipeline pl, int pos);
+
+
+/*
+ * Returns whether a pipeline is to run in the background
+ *
+ * Parameters:
+ *   pl     The pipeline
+ * 
+ * Returns: true if the command line ended with &
+ */
+bool PL_background(Pipeline pl);
+
+
+/*
+ * Returns the file the pipeline's input is redirected from
+ *
+ * Parameters:
+ *   pl     The pipeline
+ * 
+ * Returns: The filename, or NULL if input is not redirected
+ */
+const char *PL_input_file(Pipeline pl);
+
+
+/*
+ * Returns the file the pipeline's output is redirected to
+ *
+ * Parameters:
+ *   pl     The pipeline
+ * 
+ * Returns: The filename, or NULL if output is not redirected
+ */
+const char *PL_output_file(Pipeline pl);
+
+#endif /* _PIPELINE_H_ */
@@ -1,53 +1,853 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <assert.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <readline/readline.h>
 #include <readline/history.h>
+#include "arena.h"
 #include "Tokenize.h" // Include the tokenize header
+#include "pipeline.h"
+#include "executor.h"
+#include "env.h"
+#include "histfile.h"
+#include "complete.h"
+#include "stats.h"
 
-int main() {
+// Size of each read when running commands from a pipe or file
+#define BATCH_CHUNK (64 * 1024)
+
+// History file, in the home directory unless $PLAIDSH_HISTFILE is set
+#define HISTORY_FILE ".plaidsh_history"
+
+// Number of history entries loaded into readline at startup, for the
+// arrow keys; Ctrl-R and the history builtin search all of them
+#define HISTORY_LOAD 1000
+
+// Colours for highlighting the line being edited, by TokSpanKind
+static const char *span_colors[] = {
+    [TOK_SPAN_WORD] = NULL,
+    [TOK_SPAN_QUOTED] = "\033[33m",
+    [TOK_SPAN_OPERATOR] = "\033[1;36m",
+    [TOK_SPAN_ERROR] = "\033[4;31m",
+};
+
+// State shared with the batch-mode line callback
+typedef struct {
+    bool exiting;   // exit was seen; ignore the rest of the input
+    int status;     // exit status of the last command
+} BatchState;
+
+// Everything allocated while running one command: its tokens (when
+// interactive), its pipeline and argument vectors. Reset after each
+// command, so nothing can outlive it.
+static Arena command_arena;
+
+// Lexes the line being edited for highlighting, or NULL if disabled
+static TokHighlighter highlighter;
+
+
+/*
+ * Checks whether a line is the exit command
+ *
+ * Parameters:
+ *   tokens   The tokens of the line
+ *
+ * Returns: true if the line is just "exit"
+ */
+static bool is_exit(CList tokens) {
+    TokCursor cur = TOK_cursor(tokens);
+
+    return TOK_peek_type(&cur, 0) == TOK_WORD && TOK_equals(TOK_peek(&cur, 0), "exit") &&
+           TOK_peek_type(&cur, 1) == TOK_END;
+}
+
+
+/*
+ * Parses a line of tokens into a pipeline and runs it
+ *
+ * Parameters:
+ *   tokens   The tokens of the line
+ *
+ * Returns: The exit status of the pipeline
+ */
+static int run_tokens(CList tokens) {
+    char errmsg[256];
+    uint64_t start = ST_start();
+    Pipeline pipeline = PL_parse(tokens, command_arena, errmsg, sizeof(errmsg));
+    ST_record(ST_PARSE, start);
+
+    if (!pipeline) {
+        fprintf(stderr, "Parse error: %s\n", errmsg);
+        return 2;
+    }
+
+    // A background pipeline belongs to its job once started
+    bool background = PL_background(pipeline);
+    int status = EX_run(pipeline);
+    if (!background)
+        PL_free(pipeline);
+    return status;
+}
+
+
+// TOK_line_callback for batch mode: runs each line as it is completed
+static void batch_line(CList tokens, const char *errmsg, void *cb_data) {
+    BatchState *state = cb_data;
+
+    if (state->exiting)
+        return;
+
+    if (!tokens) {
+        fprintf(stderr, "Tokenization error: %s\n", errmsg);
+        state->status = 2;
+    } else if (is_exit(tokens)) {
+        state->exiting = true;
+    } else {
+        state->status = run_tokens(tokens);
+    }
+
+    ST_end_command();
+    AR_reset(command_arena);
+}
+
+
+/*
+ * Runs commands read from a file descriptor, in large chunks. When
+ * the commands share the descriptor, as with the shell's stdin, no
+ * input past the line being run may be consumed, or the commands would
+ * not see it: a seekable descriptor is wound back to the end of each
+ * line before the line runs, and anything else is read a byte at a
+ * time.
+ *
+ * Parameters:
+ *   fd       The file descriptor
+ *   shared   Whether the commands run may read from fd too
+ *
+ * Returns: The exit status of the last command
+ */
+static int run_batch_fd(int fd, bool shared) {
+    BatchState state = {false, 0};
+    TokStream ts = TOK_stream_new(batch_line, &state);
+    char *buf = malloc(BATCH_CHUNK);
+    assert(buf);
+
+    // Where the descriptor should be, when it has to be wound back
+    off_t offset = shared ? lseek(fd, 0, SEEK_CUR) : -1;
+    size_t chunk = (shared && offset < 0) ? 1 : BATCH_CHUNK;
+
+    while (!state.exiting) {
+        ssize_t n = read(fd, buf, chunk);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+
+        if (offset < 0) {
+            TOK_stream_feed(ts, buf, n);
+            continue;
+        }
+
+        // A line at a time, with fd just past the line while it runs
+        for (char *p = buf, *end = &buf[n]; p < end && !state.exiting; ) {
+            char *nl = memchr(p, '\n', end - p);
+            char *line_end = nl ? nl + 1 : end;
+
+            offset += line_end - p;
+            lseek(fd, offset, SEEK_SET);
+            TOK_stream_feed(ts, p, line_end - p);
+            p = line_end;
+
+            // If a command read from fd, the rest of buf is stale
+            off_t now = lseek(fd, 0, SEEK_CUR);
+            if (now != offset) {
+                offset = now;
+                break;
+            }
+        }
+    }
+
+    TOK_stream_finish(ts);
+    TOK_stream_free(ts);
+    free(buf);
+    return state.status;
+}
+
+
+/*
+ * Runs a script file. Regular files are mapped into memory and fed to
+ * the tokenizer in place; anything else is read in chunks.
+ *
+ * Parameters:
+ *   path     The script
+ *
+ * Returns: The exit status of the last command
+ */
+static int run_batch_file(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+
+    if (fd < 0) {
+        fprintf(stderr, "plaidsh: %s: %s\n", path, strerror(errno));
+        return 127;
+    }
+
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        int status = run_batch_fd(fd, false);
+        close(fd);
+        return status;
+    }
+
+    char *script = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (script == MAP_FAILED) {
+        fprintf(stderr, "plaidsh: %s: %s\n", path, strerror(errno));
+        return 126;
+    }
+    madvise(script, st.st_size, MADV_SEQUENTIAL);
+
+    BatchState state = {false, 0};
+    TokStream ts = TOK_stream_new(batch_line, &state);
+    TOK_stream_feed(ts, script, st.st_size);
+    TOK_stream_finish(ts);
+    TOK_stream_free(ts);
+
+    munmap(script, st.st_size);
+    return state.status;
+}
+
+
+/*
+ * Runs the commands in a string, as given to -c
+ *
+ * Parameters:
+ *   commands  The commands, one per line
+ *
+ * Returns: The exit status of the last command
+ */
+static int run_batch_string(const char *commands) {
+    BatchState state = {false, 0};
+    TokStream ts = TOK_stream_new(batch_line, &state);
+
+    TOK_stream_feed(ts, commands, strlen(commands));
+    TOK_stream_finish(ts);
+    TOK_stream_free(ts);
+
+    return state.status;
+}
+
+
+// HF_callback that adds an entry to readline's history
+static void load_entry(const char *line, size_t len, void *cb_data) {
+    char *entry = strndup(line, len);
+    add_history(entry);
+    free(entry);
+}
+
+
+/*
+ * Opens the persistent history file and loads the most recent entries
+ * into readline
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+static void open_history(void) {
+    char path[4096];
+    const char *file = EN_get("PLAIDSH_HISTFILE");
+    const char *home = EN_get("HOME");
+
+    if (file && *file)
+        snprintf(path, sizeof(path), "%s", file);
+    else if (home && *home)
+        snprintf(path, sizeof(path), "%s/%s", home, HISTORY_FILE);
+    else
+        return;
+
+    if (HF_open(path))
+        HF_tail(HISTORY_LOAD, load_entry, NULL);
+}
+
+
+/*
+ * Returns the number of columns a prompt takes up, leaving out the
+ * invisible parts marked for readline
+ *
+ * Parameters:
+ *   prompt   The prompt
+ *
+ * Returns: The width of the prompt
+ */
+static size_t prompt_width(const char *prompt) {
+    size_t width = 0;
+    bool visible = true;
+
+    for (const char *p = prompt; *p; p++) {
+        if (*p == RL_PROMPT_START_IGNORE)
+            visible = false;
+        else if (*p == RL_PROMPT_END_IGNORE)
+            visible = true;
+        else if (visible)
+            width++;
+    }
+
+    return width;
+}
+
+
+/*
+ * readline redisplay function. Lets readline draw the line, then draws
+ * it again in colour from the first token that may have changed.
+ * Lines containing anything but printable ASCII are left alone, as
+ * are the prompts of readline's searches.
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+static void highlight_redisplay(void) {
+    rl_redisplay();
+
+    if (rl_display_prompt != rl_prompt) {
+        TOK_highlighter_reset(highlighter);
+        return;
+    }
+
+    uint64_t start = ST_start();
+    const TokSpan *spans;
+    size_t from;
+    int nspans = TOK_highlight(highlighter, rl_line_buffer, rl_end, &spans, &from);
+
+    // Lines left alone are timed too, so the statistics are per key
+    for (int i = 0; i < rl_end; i++)
+        if (rl_line_buffer[i] < ' ' || rl_line_buffer[i] > '~')
+            goto done;
+
+    int rows, cols;
+    rl_get_screen_size(&rows, &cols);
+    if (cols <= 0 || (size_t) rl_end == from)
+        goto done;
+
+    // Move from the cursor to where the redraw starts
+    size_t width = prompt_width(rl_display_prompt);
+    int up = (int) ((width + rl_point) / cols) - (int) ((width + from) / cols);
+    int col = (width + from) % cols;
+
+    fputs("\0337", rl_outstream);
+    if (up > 0)
+        fprintf(rl_outstream, "\033[%dA", up);
+    else if (up < 0)
+        fprintf(rl_outstream, "\033[%dB", -up);
+    fputc('\r', rl_outstream);
+    if (col > 0)
+        fprintf(rl_outstream, "\033[%dC", col);
+
+    size_t pos = from;
+    for (int i = 0; i < nspans; i++) {
+        if (spans[i].end <= from)
+            continue;
+
+        // The space before the token, then the token
+        fwrite(&rl_line_buffer[pos], 1, spans[i].start - pos, rl_outstream);
+        pos = (spans[i].start > from) ? spans[i].start : from;
+
+        const char *color = span_colors[spans[i].kind];
+        if (color)
+            fputs(color, rl_outstream);
+        fwrite(&rl_line_buffer[pos], 1, spans[i].end - pos, rl_outstream);
+        if (color)
+            fputs("\033[0m", rl_outstream);
+        pos = spans[i].end;
+    }
+
+    fputs("\0338", rl_outstream);
+    fflush(rl_outstream);
+
+done:
+    ST_record(ST_HIGHLIGHT, start);
+}
+
+
+// Characters that must be escaped in a word, and how; the rest of the
+// escape sequences the tokenizer accepts are the character itself
+static const char escape_letters[][2] = {
+    {'\n', 'n'}, {'\r', 'r'}, {'\t', 't'},
+};
+
+// The completions of the word being completed
+static struct {
+    char **items;
+    size_t count;
+    size_t cap;
+    size_t next;    // The next to hand to readline
+} matches;
+
+
+// CO_callback that adds a completion to matches
+static void add_match(const char *match, void *cb_data) {
+    if (matches.count == matches.cap) {
+        matches.cap = matches.cap ? matches.cap * 2 : 64;
+        matches.items = realloc(matches.items, matches.cap * sizeof(char *));
+        assert(matches.items);
+    }
+
+    matches.items[matches.count] = strdup(match);
+    assert(matches.items[matches.count]);
+    matches.count++;
+}
+
+
+// readline generator: hands over the completions in matches, one per call
+static char *next_match(const char *text, int state) {
+    if (matches.next == matches.count)
+        return NULL;
+
+    // readline frees them
+    return matches.items[matches.next++];
+}
+
+
+// readline hook: whether the character at index is escaped with a backslash
+static int char_is_quoted(char *text, int index) {
+    int backslashes = 0;
+
+    while (index - backslashes > 0 && text[index - backslashes - 1] == '\\')
+        backslashes++;
+
+    return backslashes % 2;
+}
+
+
+/*
+ * readline hook: escapes the characters of a filename that the
+ * tokenizer would otherwise split or interpret
+ *
+ * Parameters:
+ *   text           The filename
+ *   match_type     SINGLE_MATCH or MULT_MATCH
+ *   quote_pointer  The quote the word was opened with, if any
+ *
+ * Returns: The escaped filename, to be freed by readline
+ */
+static char *quote_filename(char *text, int match_type, char *quote_pointer) {
+    bool quoted = (quote_pointer && *quote_pointer == '"');
+    char *escaped = malloc(2 * strlen(text) + 1);
+    assert(escaped);
+    char *p = escaped;
+
+    for (; *text; text++) {
+        char letter = *text;
+        for (size_t i = 0; i < sizeof(escape_letters) / sizeof(escape_letters[0]); i++)
+            if (escape_letters[i][0] == *text)
+                letter = escape_letters[i][1];
+
+        // Inside quotes, only the quote, backslash and $ are special
+        if (letter != *text || *text == '"' || *text == '\\' || *text == '$' ||
+            (!quoted && strchr(rl_filename_quote_characters, *text)))
+            *p++ = '\\';
+        *p++ = letter;
+    }
+    *p = '\0';
+
+    return escaped;
+}
+
+
+/*
+ * Removes the backslash escapes from a partly-typed word
+ *
+ * Parameters:
+ *   text     The word as typed
+ *
+ * Returns: The word as the tokenizer would see it, to be freed by the
+ *   caller
+ */
+static char *dequote_word(const char *text) {
+    char *word = strdup(text);
+    assert(word);
+    char *p = word;
+
+    for (; *text; text++) {
+        char c = *text;
+
+        if (c == '\\' && text[1] != '\0') {
+            c = *++text;
+            for (size_t i = 0; i < sizeof(escape_letters) / sizeof(escape_letters[0]); i++)
+                if (escape_letters[i][1] == *text)
+                    c = escape_letters[i][0];
+        }
+        *p++ = c;
+    }
+    *p = '\0';
+
+    return word;
+}
+
+
+/*
+ * readline hook: completes the word from start to end, as a command
+ * name if it is the first word of a command and as a filename otherwise
+ *
+ * Parameters:
+ *   text     The word
+ *   start    Where the word starts in rl_line_buffer
+ *   end      Where the word ends
+ *
+ * Returns: The completions, for readline, or NULL if there are none
+ */
+static char **complete_word(const char *text, int start, int end) {
+    // Never fall back to readline's own filename completion
+    rl_attempted_completion_over = 1;
+
+    int i = start;
+    while (i > 0 && (rl_line_buffer[i - 1] == ' ' || rl_line_buffer[i - 1] == '\t'))
+        i--;
+    bool command = (i == 0 || rl_line_buffer[i - 1] == '|' || rl_line_buffer[i - 1] == '&');
+
+    char *word = dequote_word(text);
+    uint64_t started = ST_start();
+
+    matches.count = matches.next = 0;
+    if (command && !strchr(word, '/'))
+        CO_commands(word, add_match, NULL);
+    else
+        CO_files(word, add_match, NULL);
+
+    ST_record(ST_COMPLETE, started);
+
+    // Filenames get a "/" after directories, and escapes
+    rl_filename_completion_desired = !command || strchr(word, '/') != NULL;
+
+    char **completions = rl_completion_matches(word, next_match);
+    free(word);
+
+    return completions;
+}
+
+
+// The entries found by the reverse search, oldest first
+static struct {
+    char **items;
+    int count;
+    int cap;
+} found;
+
+
+// HF_callback that adds an entry to found, unless it repeats the last
+static void add_found(const char *line, size_t len, void *cb_data) {
+    if (found.count > 0 && strncmp(found.items[found.count - 1], line, len) == 0 &&
+        found.items[found.count - 1][len] == '\0')
+        return;
+
+    if (found.count == found.cap) {
+        found.cap = found.cap ? found.cap * 2 : 64;
+        found.items = realloc(found.items, found.cap * sizeof(char *));
+        assert(found.items);
+    }
+
+    found.items[found.count] = strndup(line, len);
+    assert(found.items[found.count]);
+    found.count++;
+}
+
+
+// Empties found
+static void clear_found(void) {
+    for (int i = 0; i < found.count; i++)
+        free(found.items[i]);
+    found.count = 0;
+}
+
+
+/*
+ * readline command for Ctrl-R: an incremental reverse search of the
+ * whole persistent history, through its index, rather than of just
+ * the entries loaded into readline. Typing extends the query and
+ * Backspace shortens it, Ctrl-R steps to an older match and Ctrl-G
+ * gives up; any other key leaves the match on the line and is then
+ * handled as usual, so Enter runs it.
+ *
+ * Parameters:
+ *   count    Unused
+ *   key      Unused
+ *
+ * Returns: 0
+ */
+static int search_history(int count, int key) {
+    char query[256] = "";
+    size_t len = 0;
+    int pos = -1;    // The match shown, in found
+    char *saved_line = rl_copy_text(0, rl_end);
+    int saved_point = rl_point;
+
+    clear_found();
+
+    for (;;) {
+        if (pos >= 0) {
+            rl_replace_line(found.items[pos], 0);
+            rl_point = strstr(found.items[pos], query) - found.items[pos];
+        } else if (len == 0) {
+            rl_replace_line(saved_line, 0);
+            rl_point = saved_point;
+        }
+        rl_message("(%sreverse-i-search)`%s': ", (len > 0 && pos < 0) ? "failed " : "", query);
+
+        int c = rl_read_key();
+
+        if (c == CTRL('R')) {
+            if (pos > 0)
+                pos--;
+            else
+                rl_ding();
+            continue;
+        }
+
+        if (c == CTRL('G')) {
+            rl_replace_line(saved_line, 0);
+            rl_point = saved_point;
+            break;
+        }
+
+        if ((c == RUBOUT || c == CTRL('H')) && len > 0)
+            query[--len] = '\0';
+        else if (c >= ' ' && c <= '~' && len < sizeof(query) - 1) {
+            query[len++] = c;
+            query[len] = '\0';
+        } else {
+            // Anything else ends the search, and is then handled as usual
+            if (c != EOF)
+                rl_execute_next(c);
+            break;
+        }
+
+        // Search again, showing the most recent match
+        clear_found();
+        if (len > 0)
+            HF_search(query, add_found, NULL);
+        pos = found.count - 1;
+    }
+
+    clear_found();
+    rl_clear_message();
+    free(saved_line);
+    return 0;
+}
+
+
+// The line read by read_line, and whether it is complete
+static char *line_read;
+static bool line_done;
+
+// readline callback: a line (or EOF, as NULL) has been entered
+static void line_handler(char *line) {
+    line_read = line;
+    line_done = true;
+    rl_callback_handler_remove();
+}
+
+
+/*
+ * Reports background jobs that have finished while the prompt is
+ * showing, moving the prompt and the partly-typed line below the report
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+static void notify_jobs(void) {
+    if (!EX_jobs_finished())
+        return;
+
+    char *saved_line = rl_copy_text(0, rl_end);
+    int saved_point = rl_point;
+
+    rl_save_prompt();
+    rl_replace_line("", 0);
+    rl_redisplay();
+
+    EX_notify(stdout);
+
+    rl_restore_prompt();
+    rl_replace_line(saved_line, 0);
+    rl_point = saved_point;
+    if (highlighter)
+        TOK_highlighter_reset(highlighter);
+    rl_forced_update_display();
+    free(saved_line);
+}
+
+
+/*
+ * Reads a line with readline, reaping background jobs while waiting
+ * for input rather than leaving them until the line is entered
+ *
+ * Parameters:
+ *   prompt   The prompt
+ *
+ * Returns: The line, to be freed by the caller, or NULL at end of input
+ */
+static char *read_line(const char *prompt) {
+    line_read = NULL;
+    line_done = false;
+    if (highlighter)
+        TOK_highlighter_reset(highlighter);
+    rl_callback_handler_install(prompt, line_handler);
+
+    while (!line_done) {
+        struct pollfd fds[2] = {
+            {.fd = STDIN_FILENO, .events = POLLIN},
+            {.fd = EX_event_fd(), .events = POLLIN},
+        };
+
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            rl_callback_handler_remove();
+            break;
+        }
+
+        if (fds[1].revents & POLLIN)
+            notify_jobs();
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
+            rl_callback_read_char();
+    }
+
+    return line_read;
+}
+
+
+/*
+ * The interactive read-eval loop, with readline editing and history
+ *
+ * Parameters: None
+ *
+ * Returns: The exit status for the shell
+ */
+static int run_interactive(void) {
     printf(" Welocme to Plaid shell\n");
     //printf("Type 'exit' to quit.\n\n");
 
+    open_history();
+    EX_set_interactive(true);
+
+    // Highlight the line being edited, unless the terminal cannot
+    // show colours or the user does not want them. readline must read
+    // the terminal's capabilities first: it skips them if it finds a
+    // redisplay function of its caller's already installed.
+    const char *term = EN_get("TERM");
+    if (isatty(STDOUT_FILENO) && term && strcmp(term, "dumb") != 0 && !EN_get("NO_COLOR")) {
+        rl_initialize();
+        highlighter = TOK_highlighter_new();
+        rl_redisplay_function = highlight_redisplay;
+    }
+
+    // Complete command names and filenames, escaping what the
+    // tokenizer would split on
+    rl_attempted_completion_function = complete_word;
+    rl_completer_word_break_characters = " \t\n|&<>";
+    rl_completer_quote_characters = "\"";
+    rl_filename_quote_characters = " \t\n\r\"\\|&<>$";
+    rl_filename_quoting_function = quote_filename;
+    rl_char_is_quoted_p = char_is_quoted;
+
+    // Search the whole history, not just what readline has loaded
+    rl_bind_keyseq("\\C-r", search_history);
+
     while (1) {
-        // Display the prompt with bold red color
-        char *prompt = "\033[1;31m#? \033[0m";
-        char *input = readline(prompt);
+        // Display the prompt with bold red color; readline is told
+        // which parts take no space on the screen
+        char *prompt = "\001\033[1;31m\002#? \001\033[0m\002";
+        EX_notify(stdout);
+
+        uint64_t start = ST_start();
+        char *input = read_line(prompt);
+        ST_record(ST_READLINE, start);
 
         if (!input) { // EOF (Ctrl+D) handling
             printf("\nExiting. Goodbye!\n");
             break;
         }
 
-        // Check for "exit" command
-        if (strcmp(input, "exit") == 0) {
-            free(input);
-            break;
-        }
-
         // If input is not empty, add it to history
         if (*input) {
             add_history(input);
+            HF_append(input);
         }
 
         // Tokenize the input
         char errmsg[256];
-        CList tokens = TOK_tokenize_input(input, errmsg, sizeof(errmsg));
+        CList tokens = TOK_tokenize_input(input, command_arena, errmsg, sizeof(errmsg));
 
         if (!tokens) {
             // Handle tokenization error
             fprintf(stderr, "Tokenization error: %s\n", errmsg);
+        } else if (is_exit(tokens)) {
+            free(input);
+            break;
         } else {
-            // Print the tokens for debugging
-            printf("Tokens:\n");
-            TOK_print(tokens);
-
-            // Free the tokens
-            CL_free(tokens);
+            run_tokens(tokens);
         }
 
+        // Free the tokens and pipeline in one go
+        ST_end_command();
+        AR_reset(command_arena);
         free(input); // Free memory allocated by readline
     }
 
+    HF_close();
+    CO_clear();
+    TOK_highlighter_free(highlighter);
     return 0;
 }
+
+
+// atexit handler: reports statistics if they were being collected
+static void print_stats(void) {
+    if (ST_enabled)
+        ST_print(stderr);
+}
+
+
+int main(int argc, char *argv[]) {
+    // Builtins write to pipes from inside the shell; a closed pipe
+    // should give them EPIPE rather than kill the shell
+    signal(SIGPIPE, SIG_IGN);
+
+    command_arena = AR_new();
+
+    // plaidsh -s ...: collect statistics from the start
+    if (argc > 1 && strcmp(argv[1], "-s") == 0) {
+        ST_enable(true);
+        argv[1] = argv[0];
+        argc--;
+        argv++;
+    }
+    atexit(print_stats);
+
+    // plaidsh -c commands
+    if (argc == 3 && strcmp(argv[1], "-c") == 0)
+        return run_batch_string(argv[2]);
+
+    // plaidsh script
+    if (argc == 2 && argv[1][0] != '-')
+        return run_batch_file(argv[1]);
+
+    if (argc != 1) {
+        fprintf(stderr, "usage: %s [-s] [-c commands | script]\n", argv[0]);
+        return 2;
+    }
+
+    // Commands piped in: no prompt, no line editing, no history
+    if (!isatty(STDIN_FILENO))
+        return run_batch_fd(STDIN_FILENO, true);
+
+    return run_interactive();
+}
@@ -17,6 +17,9 @@ prompt_re = r"#\?.* "
 
 initial_cwd=os.getcwd()
 
+# the shell under test, for the tests that run it in batch mode
+exe=os.path.abspath(sys.argv[-1])
+
 # find the setup_playground script by searching these directories in order
 script_path = [Path(__file__).parent, Path.cwd(), Path("/var/local/isse-12")]
 setup_script = None
@@ -81,7 +84,7 @@ tests = [
     ("ls *.txt",
      "'best sitcoms.txt'[ \t]+'seven dwarfs.txt'[ \t]+shells.txt",
      True, 1),
-    ("echo $PATH", "\\$PATH", True, 1),
+    ("echo $PATH", os.getenv("PATH"), True, 1),
     ("author", "", False, 1),
     ("author | sed -e \"s/^/Written by /\"", "Written by ", False, 1),
     ("grep Happy *.txt",
@@ -106,6 +109,7 @@ tests = [
      "Operator could you help me place this call\\?", True, 1),
     ("seq 10 | wc\"-l\"", "10", True, 1),
     ('\x1b[A\x1b[A', "Operator could you help me place this call\\?", True, 2),
+    ('\x12help me pl', "Operator could you help me place this call\\?\r\n", True, 1),
 
     # additional tricky examples, some with errors
     ("env\t|grep PATH", os.getenv("PATH"), True, 2),
@@ -127,7 +131,90 @@ tests = [
     ("| grep", "No command (specified|found)", True, 1),
     ("echo || grep", "No command (specified|found)", True, 1),
     ("echo \\<\\|\\> | cat", "<\\|>", True, 1),
-    ("echo hello\\|grep ell", "hello\\|grep ell", True, 1)
+    ("echo hello\\|grep ell", "hello\\|grep ell", True, 1),
+
+    # variables
+    ("export PS_FOO=bar", "", True, 1),
+    ("echo ${PS_FOO}x", "barx", True, 1),
+    ("echo \"a $PS_FOO b\"", "a bar b", True, 1),
+    ("echo \\$PS_FOO", "\\$PS_FOO", True, 1),
+    ("echo $", "\\$", True, 1),
+    ("printf \"<%s>\\n\" a $PS_NOPE b", "<a>\r\n<b>", True, 1),
+    ("echo ${PS_FOO", "Missing } after \\$\\{", True, 1),
+    ("echo ${}", "Bad substitution: \\$\\{\\}", True, 1),
+    ("parallel -k \"echo \\$PS_FOO{}\" ::: 1 2", "bar1\r\nbar2", True, 1),
+    ("export 1BAD=x", "export: 1BAD: not a valid name", True, 1),
+    ("unset PS_FOO", "", True, 1),
+    ("echo [$PS_FOO]", "\\[\\]", True, 1),
+
+    # completion follows a directory that is replaced
+    ("rm -rf /tmp/ps_co", "", True, 1),
+    ("mkdir -p /tmp/ps_co/d", "", True, 1),
+    ("touch /tmp/ps_co/d/alpha", "", True, 1),
+    ("echo /tmp/ps_co/d/al\t", "/tmp/ps_co/d/alpha", True, 1),
+    ("rm -rf /tmp/ps_co/d", "", True, 1),
+    ("mkdir /tmp/ps_co/d", "", True, 1),
+    ("touch /tmp/ps_co/d/beta", "", True, 1),
+    ("echo /tmp/ps_co/d/b\t", "/tmp/ps_co/d/beta", True, 1),
+    ("touch /tmp/ps_co/d/gamma", "", True, 1),
+    ("echo /tmp/ps_co/d/g\t", "/tmp/ps_co/d/gamma", True, 1),
+    ("mv /tmp/ps_co/d /tmp/ps_co/old", "", True, 1),
+    ("mkdir /tmp/ps_co/d", "", True, 1),
+    ("touch /tmp/ps_co/d/delta", "", True, 1),
+    ("echo /tmp/ps_co/d/b\t", "/tmp/ps_co/d/b\r\n", True, 1),
+    ("echo /tmp/ps_co/d/d\t", "/tmp/ps_co/d/delta", True, 1),
+    ("rm -rf /tmp/ps_co", "", True, 1),
+
+    # batch modes: -c, a script, and commands piped to stdin, which
+    # must leave the lines after a command for it to read
+    (f"{exe} -c \"echo x\"", "x", True, 1),
+    (f"{exe} -c false &", "\\[1\\]  Exit 1 ", False, 1),
+    (f"{exe} -c true &", "\\[1\\]  Done ", False, 1),
+    ("printf \"echo from script\\n\" > /tmp/ps_script", "", True, 1),
+    (f"{exe} /tmp/ps_script", "from script", True, 1),
+    (f"printf \"echo a\\ncat\\n\" | {exe}", "a\r\n", True, 1),
+    (f"printf \"cat\\nhello\\necho after\\n\" | {exe}", "hello\r\necho after", True, 1),
+    (f"{exe} < /tmp/ps_script", "from script", True, 1),
+    ("rm /tmp/ps_script", "", True, 1),
+
+    # cat copies in the kernel: file to file, file or pipe to pipe,
+    # file to terminal, and reads and writes for anything else
+    ("seq 100000 > /tmp/ps_seq", "", True, 1),
+    ("cat < /tmp/ps_seq > /tmp/ps_cat", "", True, 1),
+    ("cmp /tmp/ps_seq /tmp/ps_cat", "", True, 1),
+    ("cat /tmp/ps_seq | cat | wc -l", "100000", True, 1),
+    ("printf \"one\\ntwo\\n\" > /tmp/ps_two", "", True, 1),
+    ("cat /tmp/ps_two", "one\r\ntwo", True, 1),
+    ("cat /tmp/ps_two | cat", "one\r\ntwo", True, 1),
+    ("cat /dev/null /tmp/ps_two > /tmp/ps_cat", "", True, 1),
+    ("cmp /tmp/ps_two /tmp/ps_cat", "", True, 1),
+    ("cat /tmp/ps_missing", "cat: /tmp/ps_missing: No such file or directory", True, 1),
+    ("cat /tmp/ps_missing &", "\\[1\\]  Exit 1 +cat /tmp/ps_missing", False, 1),
+    ("rm /tmp/ps_seq /tmp/ps_cat /tmp/ps_two", "", True, 1),
+
+    # background jobs
+    ("sleep 0.5 &", "\\[1\\] [0-9]+", True, 1),
+    ("jobs", "\\[1\\]  Running +sleep 0.5 &", True, 1),
+    ("wait", "", True, 1),
+    ("jobs", "", True, 1),
+    ("sleep 0.8 | cat &", "\\[1\\]", True, 1),
+    ("sleep 0.1 &", "\\[2\\] [0-9]+", True, 1),
+    ("wait %2", "", True, 1),
+    ("jobs", "\\[1\\]  Running +sleep 0.8 \\| cat &", True, 1),
+    ("wait %1", "", True, 1),
+    ("wait %7", "wait: %7: no such job", True, 1),
+    ("cd / &", "cd: cannot be used in the background", False, 1),
+    ("wait", "", False, 1),
+
+    # parallel
+    ("parallel -k echo {} ::: c b a", "c\r\nb\r\na", True, 1),
+    ("parallel -k echo x{}y ::: 1 2", "x1y\r\nx2y", True, 1),
+    ("printf \"%s\\n\" one two | parallel -k echo got", "got one\r\ngot two", True, 1),
+    ("parallel -j 1 -k echo ::: 1 2 3 | wc -l", "3", True, 1),
+    ("parallel \"echo {} |\" ::: a", "parallel: No command specified", True, 1),
+    ("parallel \"author {} | cat\" ::: a", "Pauline Uwase", True, 1),
+    ("parallel \"cd {} | cat\" ::: /", "cd: cannot be used here", False, 1),
+    ("parallel false ::: a b c &", "\\[1\\]  Exit 3 +parallel false", False, 1)
 ]
 
 def filter(line):
@@ -0,0 +1,286 @@
+/*
+ * stats.c
+ *
+ * Optional latency and activity statistics for the shell
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+// Bucket i of a histogram counts values in [2^(i-1), 2^i); bucket 0
+// counts zeros
+#define ST_NBUCKETS 65
+
+// Width of the longest histogram bar
+#define ST_BAR_WIDTH 40
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[ST_NBUCKETS];
+} Histogram;
+
+bool ST_enabled = false;
+uint64_t ST_counters[ST_NCOUNTERS];
+
+static Histogram phases[ST_NPHASES];
+static Histogram per_command[ST_NCOUNTERS];
+
+// Counter values at the end of the previous command
+static uint64_t last_counters[ST_NCOUNTERS];
+
+static const char *phase_names[ST_NPHASES] = {
+    [ST_READLINE] = "readline",
+    [ST_TOKENIZE] = "tokenize",
+    [ST_PARSE] = "parse",
+    [ST_LAUNCH] = "launch",
+    [ST_WAIT] = "wait",
+    [ST_HIGHLIGHT] = "highlight",
+    [ST_COMPLETE] = "complete",
+};
+
+static const char *counter_names[ST_NCOUNTERS] = {
+    [ST_ARENA_ALLOCS] = "arena allocs",
+    [ST_HEAP_ALLOCS] = "heap allocs",
+    [ST_LIST_OPS] = "list ops",
+};
+
+
+/*
+ * Reads the monotonic clock
+ *
+ * Parameters: None
+ * 
+ * Returns: The time in nanoseconds
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/*
+ * Adds a value to a histogram. Phases may be recorded from builtin
+ * threads, so the updates are atomic.
+ *
+ * Parameters:
+ *   h        The histogram
+ *   value    The value
+ * 
+ * Returns: None
+ */
+static void hist_add(Histogram *h, uint64_t value)
+{
+    int bucket = value ? 64 - __builtin_clzll(value) : 0;
+
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->buckets[bucket], 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (value > max &&
+           !__atomic_compare_exchange_n(&h->max, &max, value, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+
+/*
+ * Finds the upper bound of the bucket holding a percentile
+ *
+ * Parameters:
+ *   h        The histogram, which is not empty
+ *   pct      The percentile, from 0 to 100
+ * 
+ * Returns: A value no more than twice the percentile
+ */
+static uint64_t hist_percentile(const Histogram *h, double pct)
+{
+    uint64_t rank = (uint64_t) (pct / 100.0 * h->count + 0.5);
+    uint64_t seen = 0;
+
+    if (rank == 0)
+        rank = 1;
+
+    for (int i = 0; i < ST_NBUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= rank)
+            return i == 0 ? 0 : (i == 64 ? UINT64_MAX : (uint64_t) 1 << i);
+    }
+
+    return h->max;
+}
+
+
+/*
+ * Formats a value for printing
+ *
+ * Parameters:
+ *   buf      Return space for the text
+ *   buf_sz   The size of buf
+ *   value    The value
+ *   is_time  Whether value is a duration in nanoseconds
+ * 
+ * Returns: buf
+ */
+static char *format_value(char *buf, size_t buf_sz, double value, bool is_time)
+{
+    if (!is_time)
+        snprintf(buf, buf_sz, "%.0f", value);
+    else if (value < 1e3)
+        snprintf(buf, buf_sz, "%.0fns", value);
+    else if (value < 1e6)
+        snprintf(buf, buf_sz, "%.1fus", value / 1e3);
+    else if (value < 1e9)
+        snprintf(buf, buf_sz, "%.1fms", value / 1e6);
+    else
+        snprintf(buf, buf_sz, "%.2fs", value / 1e9);
+
+    return buf;
+}
+
+
+/*
+ * Prints one histogram: a summary line, then a bar for each bucket
+ * from the lowest to the highest that is in use
+ *
+ * Parameters:
+ *   out      Where to print
+ *   name     What the histogram measures
+ *   h        The histogram
+ *   is_time  Whether its values are durations in nanoseconds
+ * 
+ * Returns: None
+ */
+static void hist_print(FILE *out, const char *name, const Histogram *h, bool is_time)
+{
+    char mean[32], p50[32], p99[32], max[32];
+
+    if (h->count == 0)
+    {
+        fprintf(out, "%-12s  none\n", name);
+        return;
+    }
+
+    fprintf(out, "%-12s  n=%llu  mean=%s  p50<=%s  p99<=%s  max=%s\n", name,
+            (unsigned long long) h->count,
+            format_value(mean, sizeof(mean), (double) h->sum / h->count, is_time),
+            format_value(p50, sizeof(p50), hist_percentile(h, 50), is_time),
+            format_value(p99, sizeof(p99), hist_percentile(h, 99), is_time),
+            format_value(max, sizeof(max), h->max, is_time));
+
+    int lo = 0, hi = ST_NBUCKETS - 1;
+    uint64_t most = 0;
+    while (h->buckets[lo] == 0)
+        lo++;
+    while (h->buckets[hi] == 0)
+        hi--;
+    for (int i = lo; i <= hi; i++)
+        if (h->buckets[i] > most)
+            most = h->buckets[i];
+
+    for (int i = lo; i <= hi; i++)
+    {
+        char bound[32];
+        int width = (int) ((h->buckets[i] * ST_BAR_WIDTH + most - 1) / most);
+
+        if (i == 0)
+            snprintf(bound, sizeof(bound), "0");
+        else
+            format_value(bound, sizeof(bound), (double) ((uint64_t) 1 << (i - 1)), is_time);
+
+        fprintf(out, "  >= %-8s %8llu  %.*s\n", bound, (unsigned long long) h->buckets[i],
+                width, "########################################");
+    }
+}
+
+
+// Documented in .h file
+void ST_enable(bool enabled)
+{
+    // Counting starts afresh from here for the current command
+    if (enabled && !ST_enabled)
+        memcpy(last_counters, ST_counters, sizeof(last_counters));
+
+    ST_enabled = enabled;
+}
+
+
+// Documented in .h file
+uint64_t ST_start(void)
+{
+    return ST_enabled ? now_ns() : 0;
+}
+
+
+// Documented in .h file
+uint64_t ST_since(uint64_t start)
+{
+    return start ? now_ns() - start : 0;
+}
+
+
+// Documented in .h file
+void ST_record(StatPhase phase, uint64_t start)
+{
+    if (start == 0 || !ST_enabled)
+        return;
+
+    ST_record_ns(phase, now_ns() - start);
+}
+
+
+// Documented in .h file
+void ST_record_ns(StatPhase phase, uint64_t ns)
+{
+    if (ST_enabled)
+        hist_add(&phases[phase], ns);
+}
+
+
+// Documented in .h file
+void ST_end_command(void)
+{
+    if (!ST_enabled)
+        return;
+
+    for (int i = 0; i < ST_NCOUNTERS; i++)
+    {
+        uint64_t now = __atomic_load_n(&ST_counters[i], __ATOMIC_RELAXED);
+        hist_add(&per_command[i], now - last_counters[i]);
+        last_counters[i] = now;
+    }
+}
+
+
+// Documented in .h file
+void ST_reset(void)
+{
+    memset(phases, 0, sizeof(phases));
+    memset(per_command, 0, sizeof(per_command));
+    memset(ST_counters, 0, sizeof(ST_counters));
+    memset(last_counters, 0, sizeof(last_counters));
+}
+
+
+// Documented in .h file
+void ST_print(FILE *out)
+{
+    fprintf(out, "Time per phase:\n");
+    for (int i = 0; i < ST_NPHASES; i++)
+        hist_print(out, phase_names[i], &phases[i], true);
+
+    fprintf(out, "Events per command:\n");
+    for (int i = 0; i < ST_NCOUNTERS; i++)
+        hist_print(out, counter_names[i], &per_command[i], false);
+}
@@ -0,0 +1,152 @@
+/*
+ * stats.h
+ *
+ * Optional latency and activity statistics for the shell. When enabled
+ * (see the stats builtin), each phase of running a command is timed
+ * with the monotonic clock and allocations and list operations are
+ * counted. Everything is kept as per-session log2 histograms.
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// The timed phases of running a command
+typedef enum
+{
+    ST_READLINE,     // Waiting for the user to enter a line
+    ST_TOKENIZE,     // TOK_tokenize_input, or lexing one line of a stream
+    ST_PARSE,        // PL_parse, including filename expansion
+    ST_LAUNCH,       // Looking up and starting every stage of a pipeline
+    ST_WAIT,         // Waiting for the stages to finish
+    ST_HIGHLIGHT,    // Highlighting the line after each keystroke
+    ST_COMPLETE,     // Finding the completions of a word
+    ST_NPHASES
+} StatPhase;
+
+// The counted events, reported per command
+typedef enum
+{
+    ST_ARENA_ALLOCS,   // Allocations from an arena
+    ST_HEAP_ALLOCS,    // Calls to malloc by arenas and lists
+    ST_LIST_OPS,       // Calls to the CList operations
+    ST_NCOUNTERS
+} StatCounter;
+
+// Whether statistics are being collected; use ST_enable to change
+extern bool ST_enabled;
+
+// Running totals of the counters; use ST_count to change
+extern uint64_t ST_counters[ST_NCOUNTERS];
+
+
+/*
+ * Turn collection on or off. Statistics already collected are kept.
+ *
+ * Parameters:
+ *   enabled  Whether to collect statistics
+ * 
+ * Returns: None
+ */
+void ST_enable(bool enabled);
+
+
+/*
+ * Start timing a phase
+ *
+ * Parameters: None
+ * 
+ * Returns: A start time to pass to ST_record, or 0 if statistics
+ *   are not being collected
+ */
+uint64_t ST_start(void);
+
+
+/*
+ * Measure the time since a phase started
+ *
+ * Parameters:
+ *   start    The value returned by ST_start
+ * 
+ * Returns: The time in nanoseconds, or 0 if start is 0
+ */
+uint64_t ST_since(uint64_t start);
+
+
+/*
+ * Finish timing a phase, adding the time since start to its histogram
+ *
+ * Parameters:
+ *   phase    The phase
+ *   start    The value returned by ST_start; if 0, nothing is recorded
+ * 
+ * Returns: None
+ */
+void ST_record(StatPhase phase, uint64_t start);
+
+
+/*
+ * Add a duration to a phase's histogram
+ *
+ * Parameters:
+ *   phase    The phase
+ *   ns       The duration, in nanoseconds
+ * 
+ * Returns: None
+ */
+void ST_record_ns(StatPhase phase, uint64_t ns);
+
+
+/*
+ * Count an event. Cheap enough for hot paths: a single untaken branch
+ * when statistics are off.
+ *
+ * Parameters:
+ *   counter  The event
+ * 
+ * Returns: None
+ */
+static inline void ST_count(StatCounter counter)
+{
+    if (__builtin_expect(ST_enabled, 0))
+        __atomic_fetch_add(&ST_counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Mark the end of a command, adding the events counted while it ran
+ * to the per-command histograms
+ *
+ * Parameters: None
+ * 
+ * Returns: None
+ */
+void ST_end_command(void);
+
+
+/*
+ * Discard all statistics collected so far
+ *
+ * Parameters: None
+ * 
+ * Returns: None
+ */
+void ST_reset(void);
+
+
+/*
+ * Print a summary and histogram of each phase and counter
+ *
+ * Parameters:
+ *   out      Where to print
+ * 
+ * Returns: None
+ */
+void ST_print(FILE *out);
+
+#endif /* _STATS_H_ */
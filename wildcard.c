@@ -0,0 +1,670 @@
+/*
+ * wildcard.c
+ *
+ * Filename expansion of words containing *, ? and [...] patterns.
+ *
+ * Directories are read with raw getdents64 calls into a large buffer,
+ * so a directory of 100k entries takes a handful of system calls, and
+ * each listing is kept in a per-command cache so that several words
+ * globbing the same directory read it only once. Each pattern
+ * component is compiled once into a small matcher, with fast paths for
+ * the common prefix*suffix shapes, and the matches for a word are
+ * sorted once at the end.
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#define _GNU_SOURCE   // for O_DIRECTORY
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "wildcard.h"
+
+// Size of the buffer handed to each getdents64 call
+#define GL_DENTS_BUF (64 * 1024)
+
+// Layout of the records returned by getdents64
+struct linux_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Every entry of one directory, except . and ..
+typedef struct
+{
+    char *dir;              // The directory, as named in the pattern
+    char *names;            // The names, nul-terminated, back to back
+    size_t names_len;
+    size_t *offsets;        // Start of each name within names
+    unsigned char *types;   // d_type of each entry
+    int count;
+} DirListing;
+
+struct _gl_cache
+{
+    DirListing *dirs;
+    int count;
+    int capacity;
+};
+
+// A growable array of malloc'd strings
+typedef struct
+{
+    char **items;
+    int count;
+    int capacity;
+} StrList;
+
+typedef enum
+{
+    M_LITERAL,     // A run of ordinary characters
+    M_ANY,         // ?
+    M_STAR,        // *
+    M_CLASS        // [...]
+} MatchOpType;
+
+typedef struct
+{
+    MatchOpType type;
+    const char *text;          // M_LITERAL: the characters
+    size_t len;                // M_LITERAL: how many
+    const uint8_t *set;        // M_CLASS: 256-bit membership bitmap
+} MatchOp;
+
+// A compiled pattern component
+typedef struct
+{
+    MatchOp *ops;
+    int nops;
+    char *literals;            // Storage for the M_LITERAL text
+    uint8_t (*sets)[32];       // Storage for the M_CLASS bitmaps
+    bool dot_ok;               // Whether a leading '.' may be matched
+    bool affix;                // Just prefix*suffix: no backtracking needed
+    const char *prefix, *suffix;
+    size_t prefix_len, suffix_len;
+} Matcher;
+
+
+/*
+ * Appends a string to a list, taking ownership of it
+ *
+ * Parameters:
+ *   list     The list
+ *   str      The malloc'd string
+ * 
+ * Returns: None
+ */
+static void strlist_add(StrList *list, char *str)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->items = realloc(list->items, list->capacity * sizeof(char *));
+        assert(list->items);
+    }
+    list->items[list->count++] = str;
+}
+
+
+/*
+ * Frees a list and every string on it
+ *
+ * Parameters:
+ *   list     The list
+ * 
+ * Returns: None
+ */
+static void strlist_free(StrList *list)
+{
+    for (int i = 0; i < list->count; i++)
+        free(list->items[i]);
+    free(list->items);
+    list->items = NULL;
+    list->count = list->capacity = 0;
+}
+
+
+/*
+ * Joins a directory prefix and a name into a new path
+ *
+ * Parameters:
+ *   prefix   The directory; "" for the current directory
+ *   name     The name
+ *   len      The length of name
+ * 
+ * Returns: The malloc'd path
+ */
+static char *join_path(const char *prefix, const char *name, size_t len)
+{
+    size_t plen = strlen(prefix);
+    bool slash = plen > 0 && prefix[plen - 1] != '/';
+    char *path = malloc(plen + slash + len + 1);
+    assert(path);
+
+    memcpy(path, prefix, plen);
+    if (slash)
+        path[plen] = '/';
+    memcpy(&path[plen + slash], name, len);
+    path[plen + slash + len] = '\0';
+
+    return path;
+}
+
+
+/*
+ * Reads every entry of a directory with getdents64
+ *
+ * Parameters:
+ *   listing  The listing to fill in; listing->dir names the directory
+ * 
+ * Returns: None. A directory that cannot be read has no entries.
+ */
+static void read_dir(DirListing *listing)
+{
+    int fd = open(listing->dir[0] ? listing->dir : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    char *buf = malloc(GL_DENTS_BUF);
+    size_t names_cap = 0;
+    int capacity = 0;
+    assert(buf);
+
+    for (;;)
+    {
+        long nread = syscall(SYS_getdents64, fd, buf, GL_DENTS_BUF);
+        if (nread <= 0)
+            break;
+
+        for (long pos = 0; pos < nread;)
+        {
+            struct linux_dirent64 *d = (struct linux_dirent64 *) &buf[pos];
+            pos += d->d_reclen;
+
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+
+            size_t len = strlen(name) + 1;
+            if (listing->names_len + len > names_cap)
+            {
+                names_cap = names_cap ? names_cap * 2 : GL_DENTS_BUF;
+                while (listing->names_len + len > names_cap)
+                    names_cap *= 2;
+                listing->names = realloc(listing->names, names_cap);
+                assert(listing->names);
+            }
+            if (listing->count == capacity)
+            {
+                capacity = capacity ? capacity * 2 : 256;
+                listing->offsets = realloc(listing->offsets, capacity * sizeof(size_t));
+                listing->types = realloc(listing->types, capacity);
+                assert(listing->offsets && listing->types);
+            }
+
+            memcpy(&listing->names[listing->names_len], name, len);
+            listing->offsets[listing->count] = listing->names_len;
+            listing->types[listing->count] = d->d_type;
+            listing->names_len += len;
+            listing->count++;
+        }
+    }
+
+    free(buf);
+    close(fd);
+}
+
+
+/*
+ * Returns the listing of a directory, reading it on first use
+ *
+ * Parameters:
+ *   cache    The cache
+ *   dir      The directory; "" for the current directory
+ * 
+ * Returns: The listing, which remains owned by the cache
+ */
+static const DirListing *cache_get(GlobCache cache, const char *dir)
+{
+    for (int i = 0; i < cache->count; i++)
+        if (strcmp(cache->dirs[i].dir, dir) == 0)
+            return &cache->dirs[i];
+
+    if (cache->count == cache->capacity)
+    {
+        cache->capacity = cache->capacity ? cache->capacity * 2 : 4;
+        cache->dirs = realloc(cache->dirs, cache->capacity * sizeof(DirListing));
+        assert(cache->dirs);
+    }
+
+    DirListing *listing = &cache->dirs[cache->count++];
+    memset(listing, 0, sizeof(*listing));
+    listing->dir = strdup(dir);
+    assert(listing->dir);
+    read_dir(listing);
+
+    return listing;
+}
+
+
+/*
+ * Parses a [...] bracket expression into a bitmap
+ *
+ * Parameters:
+ *   p        The pattern, just after the '['
+ *   end      The end of the pattern
+ *   set      Return space for the bitmap
+ * 
+ * Returns: A pointer just past the closing ']', or NULL if there is
+ *   none, in which case the '[' is an ordinary character
+ */
+static const char *parse_class(const char *p, const char *end, uint8_t set[32])
+{
+    bool negate = false;
+
+    memset(set, 0, 32);
+    if (p < end && (*p == '!' || *p == '^'))
+    {
+        negate = true;
+        p++;
+    }
+
+    // A ']' right at the start is a member, not the end
+    for (bool first = true; p < end && (*p != ']' || first); first = false)
+    {
+        unsigned char lo = (unsigned char) *p++, hi = lo;
+        if (p + 1 < end && *p == '-' && p[1] != ']')
+        {
+            hi = (unsigned char) p[1];
+            p += 2;
+        }
+        for (unsigned c = lo; c <= hi; c++)
+            set[c >> 3] |= 1 << (c & 7);
+    }
+
+    if (p >= end)
+        return NULL;
+
+    if (negate)
+        for (int i = 0; i < 32; i++)
+            set[i] = ~set[i];
+
+    return p + 1;
+}
+
+
+/*
+ * Compiles one pattern component
+ *
+ * Parameters:
+ *   m        Return space for the matcher
+ *   pat      The component
+ *   len      The length of pat
+ * 
+ * Returns: None
+ */
+static void compile(Matcher *m, const char *pat, size_t len)
+{
+    const char *end = pat + len;
+    int nstars = 0;
+
+    memset(m, 0, sizeof(*m));
+    m->ops = malloc((len + 1) * sizeof(MatchOp));
+    m->literals = malloc(len + 1);
+    m->sets = malloc((len / 2 + 1) * sizeof(*m->sets));
+    assert(m->ops && m->literals && m->sets);
+    m->dot_ok = (len > 0 && pat[0] == '.');
+
+    char *lit = m->literals;
+    int nsets = 0;
+
+    for (const char *p = pat; p < end;)
+    {
+        MatchOp *prev = m->nops ? &m->ops[m->nops - 1] : NULL;
+
+        if (*p == '*')
+        {
+            if (!prev || prev->type != M_STAR)   // ** is the same as *
+            {
+                m->ops[m->nops++] = (MatchOp) {.type = M_STAR};
+                nstars++;
+            }
+            p++;
+            continue;
+        }
+
+        if (*p == '?')
+        {
+            m->ops[m->nops++] = (MatchOp) {.type = M_ANY};
+            p++;
+            continue;
+        }
+
+        if (*p == '[')
+        {
+            const char *next = parse_class(p + 1, end, m->sets[nsets]);
+            if (next != NULL)
+            {
+                m->ops[m->nops++] = (MatchOp) {.type = M_CLASS, .set = m->sets[nsets++]};
+                p = next;
+                continue;
+            }
+        }
+
+        // An ordinary character: extend the current literal run
+        if (!prev || prev->type != M_LITERAL)
+            m->ops[m->nops++] = (MatchOp) {.type = M_LITERAL, .text = lit, .len = 0};
+        m->ops[m->nops - 1].len++;
+        *lit++ = *p++;
+    }
+
+    // Spot [prefix]*[suffix], which needs no backtracking
+    if (nstars == 1)
+    {
+        m->affix = true;
+        for (int i = 0; i < m->nops; i++)
+        {
+            MatchOp *op = &m->ops[i];
+            if (op->type == M_LITERAL && i == 0)
+            {
+                m->prefix = op->text;
+                m->prefix_len = op->len;
+            }
+            else if (op->type == M_LITERAL && i == m->nops - 1)
+            {
+                m->suffix = op->text;
+                m->suffix_len = op->len;
+            }
+            else if (op->type != M_STAR)
+                m->affix = false;
+        }
+    }
+}
+
+
+static void matcher_free(Matcher *m)
+{
+    free(m->ops);
+    free(m->literals);
+    free(m->sets);
+}
+
+
+/*
+ * Matches a name against a compiled component. On a mismatch after a
+ * '*', the '*' absorbs one more character and matching resumes after
+ * it; only the most recent '*' ever needs to be retried.
+ *
+ * Parameters:
+ *   m        The matcher
+ *   name     The name
+ *   len      The length of name
+ * 
+ * Returns: true if name matches
+ */
+static bool match(const Matcher *m, const char *name, size_t len)
+{
+    if (name[0] == '.' && !m->dot_ok)
+        return false;
+
+    if (m->affix)
+        return len >= m->prefix_len + m->suffix_len &&
+               memcmp(name, m->prefix, m->prefix_len) == 0 &&
+               memcmp(&name[len - m->suffix_len], m->suffix, m->suffix_len) == 0;
+
+    int op = 0, star_op = -1;
+    size_t pos = 0, star_pos = 0;
+
+    for (;;)
+    {
+        bool ok;
+
+        if (op == m->nops)
+        {
+            if (pos == len)
+                return true;
+            ok = false;
+        }
+        else
+        {
+            const MatchOp *o = &m->ops[op];
+            switch (o->type)
+            {
+            case M_STAR:
+                star_op = op++;
+                star_pos = pos;
+                continue;
+            case M_ANY:
+                ok = pos < len;
+                pos += ok;
+                break;
+            case M_CLASS:
+                ok = pos < len && (o->set[(unsigned char) name[pos] >> 3] & (1 << (name[pos] & 7)));
+                pos += ok;
+                break;
+            default:
+                ok = len - pos >= o->len && memcmp(&name[pos], o->text, o->len) == 0;
+                if (ok)
+                    pos += o->len;
+                break;
+            }
+        }
+
+        if (ok)
+        {
+            op++;
+            continue;
+        }
+
+        // backtrack: let the last '*' absorb one more character
+        if (star_op < 0 || star_pos >= len)
+            return false;
+        pos = ++star_pos;
+        op = star_op + 1;
+    }
+}
+
+
+/*
+ * Checks whether a directory entry is itself a directory
+ *
+ * Parameters:
+ *   listing  The listing
+ *   i        Index of the entry
+ *   path     The entry's full path
+ * 
+ * Returns: true if the entry is a directory, or a link to one
+ */
+static bool is_dir_entry(const DirListing *listing, int i, const char *path)
+{
+    struct stat st;
+
+    if (listing->types[i] == DT_DIR)
+        return true;
+    if (listing->types[i] != DT_LNK && listing->types[i] != DT_UNKNOWN)
+        return false;
+
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+
+static int compare_strings(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+
+// Documented in .h file
+GlobCache GL_cache_new(void)
+{
+    GlobCache cache = calloc(1, sizeof(struct _gl_cache));
+    assert(cache);
+    return cache;
+}
+
+
+// Documented in .h file
+void GL_cache_free(GlobCache cache)
+{
+    if (cache == NULL)
+        return;
+
+    for (int i = 0; i < cache->count; i++)
+    {
+        free(cache->dirs[i].dir);
+        free(cache->dirs[i].names);
+        free(cache->dirs[i].offsets);
+        free(cache->dirs[i].types);
+    }
+    free(cache->dirs);
+    free(cache);
+}
+
+
+// Documented in .h file
+bool GL_is_pattern(const char *text, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        if (text[i] == '*' || text[i] == '?' || text[i] == '[')
+            return true;
+
+    return false;
+}
+
+
+// Documented in .h file
+int GL_expand(GlobCache cache, const char *pattern, char ***matches)
+{
+    StrList paths = {0}, next = {0};
+    bool last_literal = false;
+
+    // Every path built so far; "" is the current directory
+    char *root = strdup(*pattern == '/' ? "/" : "");
+    assert(root);
+    strlist_add(&paths, root);
+
+    for (const char *comp = pattern; *comp;)
+    {
+        while (*comp == '/')
+            comp++;
+        size_t len = strcspn(comp, "/");
+        if (len == 0)
+            break;
+
+        bool is_last = (comp[len] == '\0');
+        bool want_dir = !is_last;    // including for a trailing slash
+
+        if (!GL_is_pattern(comp, len))
+        {
+            for (int i = 0; i < paths.count; i++)
+                strlist_add(&next, join_path(paths.items[i], comp, len));
+            last_literal = true;
+        }
+        else
+        {
+            Matcher m;
+            compile(&m, comp, len);
+
+            for (int i = 0; i < paths.count; i++)
+            {
+                const DirListing *listing = cache_get(cache, paths.items[i]);
+
+                for (int e = 0; e < listing->count; e++)
+                {
+                    const char *name = &listing->names[listing->offsets[e]];
+                    if (!match(&m, name, strlen(name)))
+                        continue;
+
+                    char *path = join_path(paths.items[i], name, strlen(name));
+                    if (want_dir && !is_dir_entry(listing, e, path))
+                    {
+                        free(path);
+                        continue;
+                    }
+                    strlist_add(&next, path);
+                }
+            }
+
+            matcher_free(&m);
+            last_literal = false;
+        }
+
+        strlist_free(&paths);
+        paths = next;
+        next = (StrList) {0};
+        comp += len;
+
+        // keep a trailing slash, as other shells do
+        if (is_last || comp[strspn(comp, "/")] == '\0')
+        {
+            if (*comp == '/')
+                for (int i = 0; i < paths.count; i++)
+                {
+                    char *p = join_path(paths.items[i], "", 0);
+                    free(paths.items[i]);
+                    paths.items[i] = p;
+                }
+            break;
+        }
+    }
+
+    // Literal components after the last wildcard were never checked
+    if (last_literal)
+    {
+        int kept = 0;
+        struct stat st;
+        for (int i = 0; i < paths.count; i++)
+        {
+            if (lstat(paths.items[i], &st) == 0)
+                paths.items[kept++] = paths.items[i];
+            else
+                free(paths.items[i]);
+        }
+        paths.count = kept;
+    }
+
+    *matches = NULL;
+    int n = paths.count;
+    if (n == 0)
+    {
+        strlist_free(&paths);
+        return 0;
+    }
+
+    qsort(paths.items, n, sizeof(char *), compare_strings);
+
+    // Pack the results into a single block
+    size_t bytes = 0;
+    for (int i = 0; i < n; i++)
+        bytes += strlen(paths.items[i]) + 1;
+
+    char **block = malloc((n + 1) * sizeof(char *) + bytes);
+    assert(block);
+    char *strings = (char *) &block[n + 1];
+
+    for (int i = 0; i < n; i++)
+    {
+        size_t len = strlen(paths.items[i]) + 1;
+        memcpy(strings, paths.items[i], len);
+        block[i] = strings;
+        strings += len;
+    }
+    block[n] = NULL;
+
+    strlist_free(&paths);
+    *matches = block;
+    return n;
+}
@@ -0,0 +1,73 @@
+/*
+ * wildcard.h
+ *
+ * Filename expansion of words containing *, ? and [...] patterns
+ *
+ * Author: <Pauline Uwase>
+ */
+
+#ifndef _WILDCARD_H_
+#define _WILDCARD_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Directory listings read while expanding the words of one command
+// (struct _gl_cache is defined in .c file)
+typedef struct _gl_cache *GlobCache;
+
+
+/*
+ * Create an empty directory cache. Each directory is read at most once
+ * for as long as the cache lives, so a cache should live for one
+ * command.
+ *
+ * Parameters: None
+ * 
+ * Returns: The new cache, to be destroyed with GL_cache_free
+ */
+GlobCache GL_cache_new(void);
+
+
+/*
+ * Destroy a directory cache
+ *
+ * Parameters:
+ *   cache    The cache; if NULL, no action will occur
+ * 
+ * Returns: None
+ */
+void GL_cache_free(GlobCache cache);
+
+
+/*
+ * Check whether a word contains any wildcard characters
+ *
+ * Parameters:
+ *   text     The word; need not be nul-terminated
+ *   len      The length of text
+ * 
+ * Returns: true if the word is a pattern
+ */
+bool GL_is_pattern(const char *text, size_t len);
+
+
+/*
+ * Expand a pattern into the sorted list of existing paths it matches.
+ * Wildcards may appear in any component of the pattern. As in other
+ * shells, wildcards do not match a leading '.' unless the pattern
+ * component itself starts with one.
+ *
+ * Parameters:
+ *   cache    The directory cache to read through
+ *   pattern  The pattern
+ *   matches  Return space for the matches: a single malloc'd block
+ *            holding a NULL-terminated array of pointers followed by
+ *            the strings, to be released with one call to free
+ * 
+ * Returns: The number of matches. If there are none, *matches is set
+ *   to NULL.
+ */
+int GL_expand(GlobCache cache, const char *pattern, char ***matches);
+
+#endif /* _WILDCARD_H_ */